@@ -0,0 +1,35 @@
+#ifndef __BATCH_HPP__
+#define __BATCH_HPP__
+
+#include "mlx90640_frame.hpp"
+
+// Frames per work unit. Large enough that the one-frame warm-up is noise,
+// small enough to balance the tail across threads.
+#define BATCH_CHUNK_FRAMES 256
+
+struct batch_config {
+    const char * in_path;       // --save-raw recording
+    const char * out_path;      // GRAY16 frames, the same format as --save
+    bool extended;              // 27 lines per frame
+    bool fixed_point;
+    unsigned jobs;              // 0: one per CPU
+    unsigned chunk_frames;      // 0: BATCH_CHUNK_FRAMES
+};
+
+struct batch_stats {
+    unsigned long frames;
+    double seconds;
+    mlx90640_frame::map_counters counters;
+};
+
+// Headless replay of a whole recording on a thread pool.
+// The recording is cut into chunks, each worker processes a chunk with its
+// own copy of proto (so proto's kernel and root settings apply) straight
+// from the mapped recording, and writes it to its place in the output with
+// pwrite(), so the output is in order.
+// A chunk starts one frame early to fill the other subpage of To[], which
+// makes the output identical to a serial run.
+bool run_batch(const mlx90640_frame & proto, const batch_config & config,
+               batch_stats * stats);
+
+#endif // __BATCH_HPP__
@@ -14,16 +14,27 @@
 #include <sys/ioctl.h>
 
 #include <linux/videodev2.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-heap.h>
 
+#include "raw_codec.hpp"
+#include "recording.hpp"
+
+// Default capture ring depth, see set_buffer_count()
 #define BUF_COUNT 2
 
 #define CLEAR(x) memset(&(x), 0, sizeof(x))
 
+// Where IO_METHOD_DMABUF allocates its buffers from
+#define DMA_HEAP_PATH "/dev/dma_heap/system"
+
 class dev_handler {
 public:
     enum io_method_ {
         IO_METHOD_READ,
-        IO_METHOD_MMAP
+        IO_METHOD_MMAP,
+        IO_METHOD_USERPTR,  // driver fills our own page-aligned buffers
+        IO_METHOD_DMABUF    // driver fills dma-bufs we allocate from DMA_HEAP_PATH
     };
 
 private:
@@ -44,8 +55,32 @@ private:
     struct buffer {
         void   *start;
         size_t  length;
+        int     dmabuf_fd;  // DMABUF: the imported buffer, else -1
     };
     struct buffer *buffers;
+    unsigned int buf_count;
+
+    bool latest_only;
+    unsigned long skipped;
+
+    // Raw file replay from a mapping, see map_raw()
+    const unsigned char * raw_map;
+    size_t raw_map_length;
+    unsigned long raw_frames;
+    unsigned long raw_next;
+
+    // Compressed recording (raw_codec.hpp), mapped and decoded in order
+    const unsigned char * packed_map;
+    size_t packed_length;
+    raw_decoder * decoder;
+
+    // Recording container (recording.hpp); raw_map then points at its
+    // first frame and is owned by it
+    recording * container;
+
+    // Buffer handed out by acquire_frame(), still dequeued
+    struct v4l2_buffer held;
+    bool holding;
 
 public:
     dev_handler(int _io_method = -1, int _fps = -1, bool extended_format = false)
@@ -55,17 +90,34 @@ public:
         open_ = false;
         init = false;
         capturing = false;
+        holding = false;
+        raw_map = NULL;
+        raw_map_length = 0;
+        raw_frames = 0;
+        raw_next = 0;
+        packed_map = NULL;
+        packed_length = 0;
+        decoder = NULL;
+        container = NULL;
+        buf_count = BUF_COUNT;
+        latest_only = false;
+        skipped = 0;
     }
     ~dev_handler() {
         if (is_dev) {
+            if (holding) release_frame();
             if (capturing) stop_capturing();
             if (init) uninit_device();
         }
+        if (container) delete container;
+        else if (raw_map) munmap((void *)raw_map, raw_map_length);
+        delete decoder;
+        if (packed_map) munmap((void *)packed_map, packed_length);
         if (open_) close_device();
     }
 
 private: // basic tools
-    int xioctl(int fh, int request, void *arg)
+    int xioctl(int fh, unsigned long request, void *arg)
     {
         int r;
 
@@ -88,9 +140,21 @@ private: // getting to work
     void init_mmap(void);
 
     void init_read(unsigned int buffer_size);
-
-    bool read_raw(void * dest);
+    void init_userp(unsigned int buffer_size);
+    void init_dmabuf(unsigned int buffer_size);
+    void request_buffers(enum v4l2_memory memory);
+    void queue_buffer(unsigned int index);
+    void sync_buffer(unsigned int index, bool start);
+
+    void map_raw(off_t size);
+    bool map_packed(off_t size);
+    bool map_container(const char * path);
+    void pace_replay(void);
+    bool read_raw(void * dest, bool pace = true);
     int read_v4l2_frame(void * dest);
+    int dequeue_buffer(struct v4l2_buffer * buf);
+    int dequeue_frame(struct v4l2_buffer * buf);
+    void wait_for_frame(void);
 
 private: // cleanups
     void stop_capturing(void);
@@ -98,13 +162,59 @@ private: // cleanups
     void close_device(void);
 
 public:
+    // Both only take effect for streaming V4L2 i/o, and must be set before
+    // init_frame_file(). The driver may round the count, and one buffer is
+    // out of the ring while a zero-copy frame is held.
+    void set_buffer_count(unsigned int count) { buf_count = count; }
+    // Low latency: every dequeue returns the newest ready frame and requeues
+    // the older ones unprocessed. skipped_frames() counts those.
+    void set_latest_only(bool latest) { latest_only = latest; }
+    unsigned long skipped_frames(void) { return skipped; }
+
     void init_frame_file(const char * path);
     void start_capturing(void);
     bool read_frame_file(void * dest);
 
+    // Zero-copy alternative to read_frame_file(): returns a read-only view of
+    // the dequeued mmap buffer. It stays valid, and stays out of the driver's
+    // queue, until release_frame(). One frame may be held at a time.
+    // For a mapped raw file, a view into the mapping, valid for the lifetime
+    // of the dev_handler; NULL at the end of the file.
+    bool can_zero_copy(void) {
+        return is_dev ? io_method != IO_METHOD_READ : raw_map != NULL;
+    }
+    const void * acquire_frame(void);
+    void release_frame(void);
+
+    // For callers running their own event loop: poll_fd() becomes readable
+    // when a V4L2 frame is ready (-1 for raw files, which are always ready),
+    // and try_read_frame() neither waits for it nor paces raw file replay.
+    // false means no frame yet for a device, end of file for a raw file.
+    int poll_fd(void) { return is_dev ? fd : -1; }
+    bool try_read_frame(void * dest);
+    // Replay pacing for raw files as set by --fps, 0 for as fast as possible
+    int frame_period_ns(void);
+
+    // Random access into a mapped raw file or recording. frame_count() is 0
+    // if the file could not be mapped (e.g. a pipe) or is compressed, which
+    // only supports reading in order.
+    unsigned long frame_count(void) { return raw_frames; }
+    // Replay a recording container from the first frame read at least
+    // seconds after its first one, see recording::seek_time(). Before the
+    // first read; false if this is not a recording.
+    bool seek_start(double seconds);
+    const void * frame_ptr(unsigned long n) {
+        return raw_map + n * (extended ? 0x6c0 : 0x680);
+    }
+
     bool is_extended(void) {
         return extended;
     }
+
+    // false when replaying a raw file
+    bool is_device(void) {
+        return is_dev;
+    }
 };
 
 #endif // __DEV_HANDLER_HPP__
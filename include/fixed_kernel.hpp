@@ -0,0 +1,50 @@
+#ifndef __FIXED_KERNEL_HPP__
+#define __FIXED_KERNEL_HPP__
+
+#include <cstdint>
+
+// Integer-only compensation for cores without a (fast) FPU.
+//
+// Per pixel, in the datasheet's terms:
+//     pix = raw * gain - offset_ref * (1 + K_Ta * dTa) * (1 + K_V * dV)
+//     To  = (pix / a_ref + T_ar) ^ 0.25
+// with every factor kept as an integer scaled by a power of two:
+//     gain, 1 + K_Ta * dTa, 1 + K_V * dV    Q16
+//     pix                                   Q8
+//     1 / a_ref                             inv_a, Q(FIXED_INV_A_SHIFT) of 2^a_scale / a_ref_int
+//     pix / a_ref + T_ar                    integer K^4
+// and the root taken with two integer square roots, giving To in centi-Kelvin.
+//
+// The intermediate products assume |pix| < 2^15, which the 16-bit ADC
+// guarantees for any sane EE. Pixels with a non-positive a_ref or
+// pix / a_ref + T_ar <= 0 come out as 0 cK.
+//
+// Against the double path this stays within one centi-Kelvin (rounding),
+// see mlx90640_bench -a.
+
+#define FIXED_INV_A_SHIFT 4
+
+struct fixed_kernel_args {
+    const int16_t * ram_PIX;
+    const int * offset_ref;
+    const int * K_Ta;           // K_Ta * 2^K_Ta_scale
+    const uint32_t * inv_a;     // 2^(a_scale + FIXED_INV_A_SHIFT) / a_ref_int, 0 = invalid
+    unsigned K_Ta_scale;
+
+    // frame constants, see mlx90640::process_pixel_fixed()
+    int32_t gain;               // Q16
+    int32_t dTa;                // Q16
+    int32_t K_V_dV[2][2];       // 1 + K_V * dV, Q16
+    int64_t T_ar;               // K^4
+
+    bool extended;
+    int subpage;
+
+    int32_t * To_cK;
+};
+
+uint32_t isqrt64(uint64_t x);
+
+void fixed_kernel(const fixed_kernel_args & args);
+
+#endif // __FIXED_KERNEL_HPP__
@@ -0,0 +1,104 @@
+#ifndef __FOURTH_ROOT_HPP__
+#define __FOURTH_ROOT_HPP__
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+// x ^ 0.25 for To = (pix / a_ref + T_ar) ^ 0.25 - 273.15.
+//
+// Maximum error of To over the sensor range, -40..300 degC (x = 2.96e9..1.08e11),
+// against long double powl(), as measured by mlx90640_bench -r:
+//
+//   method        double        float
+//   ROOT_POW      4.3e-14 K     3.1e-05 K    libm pow() / powf()
+//   ROOT_SQRT     4.3e-14 K     4.6e-05 K    two correctly rounded square roots
+//   ROOT_NEWTON   1.9e-06 K     2.5e-04 K    bit-trick estimate + 3 Newton steps
+//
+// The float column is dominated by rounding x itself to float.
+// The vector kernels have no pow(), they take ROOT_POW as ROOT_SQRT.
+enum root_method {
+    ROOT_POW,
+    ROOT_SQRT,
+    ROOT_NEWTON
+};
+
+// Newton-Raphson on r = x ^ -0.25, which needs no division:
+//     r' = r * (1.25 - 0.25 * x * r^4)
+// then x ^ 0.25 = x * r^3.
+// The magic constants put the initial estimate within ~10% over the whole
+// range, three steps bring it to ~2e-9 relative.
+#define ROOT_NEWTON_MAGIC_F64 0x4feb200000000000ULL
+#define ROOT_NEWTON_MAGIC_F32 0x4f58e000U
+#define ROOT_NEWTON_STEPS 3
+
+static inline double fourth_root_newton(double x) {
+    uint64_t i;
+    memcpy(&i, &x, sizeof(i));
+    i = ROOT_NEWTON_MAGIC_F64 - (i >> 2);
+    double r;
+    memcpy(&r, &i, sizeof(r));
+
+    for (int n = 0; n < ROOT_NEWTON_STEPS; n++) {
+        double r2 = r * r;
+        r = r * (1.25 - 0.25 * x * r2 * r2);
+    }
+    return x * r * r * r;
+}
+
+static inline float fourth_root_newton(float x) {
+    uint32_t i;
+    memcpy(&i, &x, sizeof(i));
+    i = ROOT_NEWTON_MAGIC_F32 - (i >> 2);
+    float r;
+    memcpy(&r, &i, sizeof(r));
+
+    for (int n = 0; n < ROOT_NEWTON_STEPS; n++) {
+        float r2 = r * r;
+        r = r * (1.25f - 0.25f * x * r2 * r2);
+    }
+    return x * r * r * r;
+}
+
+template<root_method R>
+static inline double fourth_root(double x) {
+    if constexpr (R == ROOT_POW)
+        return pow(x, 0.25);
+    else if constexpr (R == ROOT_SQRT)
+        return sqrt(sqrt(x));
+    else
+        return fourth_root_newton(x);
+}
+
+template<root_method R>
+static inline float fourth_root(float x) {
+    if constexpr (R == ROOT_POW)
+        return powf(x, 0.25f);
+    else if constexpr (R == ROOT_SQRT)
+        return sqrtf(sqrtf(x));
+    else
+        return fourth_root_newton(x);
+}
+
+// Name as accepted on the command line, or nullptr.
+static inline const char * root_method_name(root_method r) {
+    switch (r) {
+    case ROOT_POW:      return "pow";
+    case ROOT_SQRT:     return "sqrt";
+    case ROOT_NEWTON:   return "newton";
+    }
+    return nullptr;
+}
+
+static inline bool parse_root_method(const char * name, root_method * r) {
+    static const root_method methods[] = { ROOT_POW, ROOT_SQRT, ROOT_NEWTON };
+    for (root_method m : methods) {
+        if (strcmp(name, root_method_name(m)) == 0) {
+            *r = m;
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif // __FOURTH_ROOT_HPP__
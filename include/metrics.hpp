@@ -0,0 +1,113 @@
+#ifndef __METRICS_HPP__
+#define __METRICS_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "mlx90640_frame.hpp"
+
+// Live metrics for scraping, in the Prometheus text format over HTTP:
+//     curl http://127.0.0.1:PORT/metrics
+//     curl --unix-socket PATH http://localhost/metrics
+// One sensor_metrics per sensor; the frame loops update them with relaxed
+// atomics, the server thread only reads them.
+
+enum metrics_stage {
+    STAGE_READ,             // waiting for and reading the frame
+    STAGE_PROCESS_FRAME,
+    STAGE_PROCESS_PIXEL,    // with the GRAY16 mapping
+    STAGE_SAVE,             // queueing for --save and --save-raw
+    STAGE_PUSH,             // into GStreamer
+    STAGE_COUNT
+};
+
+// Four buckets per power of two of nanoseconds, up to 2^40 ns (~18 min):
+// quantiles come out within 12%, which is enough to alert on.
+#define LATENCY_BUCKETS 160
+
+class latency_histogram {
+public:
+    latency_histogram();
+
+    void record(uint64_t ns);
+    // Estimated q-quantile in ns, 0 if nothing was recorded yet
+    double quantile(double q) const;
+    uint64_t count(void) const { return total.load(std::memory_order_relaxed); }
+    uint64_t sum_ns(void) const { return sum.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> buckets[LATENCY_BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum;
+};
+
+struct sensor_metrics {
+    sensor_metrics();
+
+    std::atomic<unsigned long> captured;
+    std::atomic<unsigned long> processed;
+    std::atomic<unsigned long> pushed;
+    // GStreamer asked us to stop feeding (stop_feed), so the frame was discarded
+    std::atomic<unsigned long> dropped_backpressure;
+    // --pipeline: rings full
+    std::atomic<unsigned long> dropped_capture;
+    std::atomic<unsigned long> dropped_compute;
+    // --save/--save-raw queue full, the frame was not recorded
+    std::atomic<unsigned long> dropped_recorder;
+    // --latest
+    std::atomic<unsigned long> skipped_stale;
+    std::atomic<unsigned long> clamped_too_big;
+    std::atomic<unsigned long> clamped_negative;
+
+    latency_histogram stage[STAGE_COUNT];
+
+    // Of the last processed frame
+    std::atomic<double> Ta;
+    std::atomic<double> Vdd;
+    std::atomic<double> T_min;
+    std::atomic<double> T_max;
+
+    // Call after process_pixel*()
+    void frame_processed(mlx90640_frame & frame);
+    void frame_pushed(bool dropped) {
+        if (dropped)
+            dropped_backpressure.fetch_add(1, std::memory_order_relaxed);
+        else
+            pushed.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+// Times one stage into m's histogram, for the lifetime of the object.
+// Does nothing if m is nullptr, i.e. metrics are off.
+class stage_timer {
+public:
+    stage_timer(sensor_metrics * m_, metrics_stage s_) : m(m_), s(s_) {
+        if (m)
+            begin = std::chrono::steady_clock::now();
+    }
+    ~stage_timer() {
+        if (m)
+            m->stage[s].record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - begin).count());
+    }
+
+    stage_timer(const stage_timer &) = delete;
+    stage_timer & operator=(const stage_timer &) = delete;
+
+private:
+    sensor_metrics * m;
+    metrics_stage s;
+    std::chrono::steady_clock::time_point begin;
+};
+
+// address: "unix:PATH", or "PORT" for HTTP on 127.0.0.1:PORT.
+// Serves from a thread of its own until metrics_stop(). false on errors,
+// with the reason printed.
+bool metrics_start(const char * address, size_t sensors);
+void metrics_stop(void);
+// nullptr unless metrics_start() succeeded, which stage_timer and the
+// callers take as "metrics off"
+sensor_metrics * metrics_sensor(size_t n);
+
+#endif // __METRICS_HPP__
@@ -1,131 +1,100 @@
 #ifndef __MLX90640_H__
 #define __MLX90640_H__
 
-#include <iostream>
-
-#include <fcntl.h>
-#include <unistd.h>
-#include <endian.h>
-#include <cmath>
-
 #include "memory_mlx90640.hpp"
 #include "dev_handler.hpp"
+#include "mlx90640_calibration.hpp"
+#include "mlx90640_frame.hpp"
 
-class mlx90640 {
+// One sensor: its calibration, one frame context working on it, and the
+// frame source. For several frames in flight, make more mlx90640_frame
+// contexts on calibration().
+class mlx90640 : public mlx90640_frame {
 public:
-    mlx90640() { dev = nullptr; }
+    // The base only keeps a pointer to calib, filled in by init_ee()
+    mlx90640() : mlx90640_frame(calib) {
+        dev = nullptr;
+        zero_copy = false;
+    }
     ~mlx90640() {}
 
-private:
-    mlx90640_nvmem_ ee;
-
-    int K_Vdd_EE;
-    int Vdd_25_EE;
-    double a_PTAT;
-    double K_V_PTAT;
-    double K_T_PTAT;
-    int V_PTAT_25;
-
-    int offset_ref[0x300];
-    double a_ref[0x300];
-
-    int gain_ee;
-    double K_V[2][2];
-    double K_Ta[0x300];
-
-public: // temporary for debug
-    int get_K_Vdd_EE() {return K_Vdd_EE;}
-    int get_Vdd25_EE() {return Vdd_25_EE;}
-    double get_a_PTAT() {return a_PTAT;}
-    double get_K_V_PTAT() {return K_V_PTAT;}
-    double get_K_T_PTAT() {return K_T_PTAT;}
-    int get_V_PTAT_25() {return V_PTAT_25;}
-
-    void print_ee(void);
+    // The frame context points into this object
+    mlx90640(const mlx90640 &) = delete;
+    mlx90640 & operator=(const mlx90640 &) = delete;
 
 private:
-    bool read_ee(const char * path);
-    unsigned short fetch_EE_address(int address);
+    mlx90640_calibration calib;
 
 public:
-    bool init_ee(const char * path, bool ignore_ee_check);
-
-private:
-    mlx90640_ram_ ram;
-    dev_handler * dev;
-
-    int VDD_raw;
-    int V_PTAT;
-    int V_BE;
-    int gain_ram;
-
-    bool extended;
-    int subpage;
+    bool init_ee(const char * path, bool ignore_ee_check) {
+        return calib.init_ee(path, ignore_ee_check);
+    }
+    const uint16_t * ee_words(void) const { return calib.ee_words(); }
 
 public: // temporary for debug
-    int get_VDD_raw() {return VDD_raw;}
-    int get_V_PTAT() {return V_PTAT;}
-    int get_V_BE() {return V_BE;}
+    int get_K_Vdd_EE() {return calib.get_K_Vdd_EE();}
+    int get_Vdd25_EE() {return calib.get_Vdd25_EE();}
+    double get_a_PTAT() {return calib.get_a_PTAT();}
+    double get_K_V_PTAT() {return calib.get_K_V_PTAT();}
+    double get_K_T_PTAT() {return calib.get_K_T_PTAT();}
+    int get_V_PTAT_25() {return calib.get_V_PTAT_25();}
+
+    void print_ee(void) { calib.print_ee(); }
 
 private:
-    unsigned short fetch_RAM_address(int address);
-    unsigned short fetch_reg_address(int address);
+    dev_handler * dev;
+    // With zero_copy, the frame is viewed in the driver's buffer
+    // until release_frame(), or in the mapped recording.
+    bool zero_copy;
 
 public:
-    void init_frame_file(dev_handler* dev_) {
+    // zero_copy_: process straight from the driver's buffer or the mapped
+    // recording when possible; otherwise, or if false, every frame is copied.
+    void init_frame_file(dev_handler* dev_, bool zero_copy_ = true) {
         dev = dev_;
+        zero_copy = zero_copy_ && dev->can_zero_copy();
 
         extended = dev->is_extended();
         dev->start_capturing();
     }
 
     bool process_frame_file() {
-        if (!dev->read_frame_file(ram.word_))
-            return false;
-
-        VDD_raw = ram.named.VDD_raw;
-        V_PTAT = ram.named.Ta_PTAT; // p18 says Ta_PTAT but p23 says V_PTAT
-        V_BE = ram.named.V_BE;
-
-        gain_ram = ram.named.ram_GAIN;
-
+        if (zero_copy) {
+            release_frame();
+            view = (const mlx90640_ram_ *)dev->acquire_frame();
+            if (view == nullptr)
+                return false;
+        } else {
+            if (!dev->read_frame_file(ram.word_))
+                return false;
+            view = nullptr;
+        }
+
+        parse_ram();
         return true;
     }
 
-    enum PIX_NOTE {
-        MIN_T,
-        MAX_T,
-        SCENE_CENTER
-    };
-
-    struct pixel {
-        int x;
-        int y;
-        double T;
-    };
-    typedef pixel notable_pxls_t[3];
-
-private:
-    double dV;
-    double V_PTAT_art;
-    double dTa;
-    double gain;
-    double T_ar;
-    double e;
-
-    double pix[0x300];
-    double To[0x300];
+    // Hand a zero-copy frame back to the driver. Call once the raw frame is
+    // no longer needed, i.e. after process_pixel*() and Pix_Raw_() users.
+    // No-op on the copying path; process_frame_file() also does it implicitly.
+    void release_frame() {
+        if (zero_copy && view != nullptr) {
+            dev->release_frame();
+            view = nullptr;
+        }
+    }
 
-    notable_pxls_t pix_list;
+    bool is_zero_copy() { return zero_copy; }
 
-public:
-    void process_frame(void);
-    void process_pixel(void);
-
-    const double * To_() { return To; }
-    const uint16_t * Pix_Raw_() { return ram.word_; }
-    const notable_pxls_t * pix_notable() { return &pix_list; }
+    void load_frame(const void * src) {
+        release_frame();
+        mlx90640_frame::load_frame(src);
+    }
 
+    void view_frame(const void * src) {
+        release_frame();
+        mlx90640_frame::view_frame(src);
+    }
 };
 
 #endif // __MLX90640_H__
@@ -0,0 +1,85 @@
+#ifndef __MLX90640_CALIBRATION_HPP__
+#define __MLX90640_CALIBRATION_HPP__
+
+#include <iostream>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <endian.h>
+#include <cmath>
+
+#include "memory_mlx90640.hpp"
+#include "fixed_kernel.hpp"
+
+// Everything derived from a sensor's EE.
+// Only init_ee() writes to it; afterwards it is read-only and can be shared
+// by any number of mlx90640_frame contexts, on any number of threads.
+class mlx90640_calibration {
+    friend class mlx90640_frame;
+
+public:
+    mlx90640_calibration() : ee() {}
+    ~mlx90640_calibration() {}
+
+private:
+    mlx90640_nvmem_ ee;
+
+    int K_Vdd_EE;
+    int Vdd_25_EE;
+    double a_PTAT;
+    double K_V_PTAT;
+    double K_T_PTAT;
+    int V_PTAT_25;
+
+    int offset_ref[0x300];
+    double a_ref[0x300];
+
+    int gain_ee;
+    double K_V[2][2];
+    double K_Ta[0x300];
+
+    // Calibration plan: the datasheet formula rearranged so that
+    //     To = (raw * scale + bias) ^ 0.25 - 273.15
+    // build_plan() fills these EE-only columns once,
+    // mlx90640_frame::fold_plan() bakes a frame's constants into scale/bias.
+    // Structure of arrays, so the kernels can stream through it.
+    struct {
+        alignas(32) double inv_a[0x300];        // 1 / a_ref
+        alignas(32) double off_a[0x300];        // offset_ref / a_ref
+        alignas(32) double off_K_Ta_a[0x300];   // offset_ref * K_Ta / a_ref
+        alignas(32) double K_V[0x300];          // K_V[row%2][col%2]
+    } plan;
+
+    // Integer form of the EE tables for process_pixel_fixed(), see fixed_kernel.hpp.
+    struct {
+        int K_Ta[0x300];        // K_Ta * 2^K_Ta_scale
+        unsigned K_Ta_scale;
+        int K_V[2][2];          // K_V * 2^K_V_scale
+        unsigned K_V_scale;
+        uint32_t inv_a[0x300];  // 2^(a_scale + FIXED_INV_A_SHIFT) / a_ref_int
+    } fixed;
+
+public: // temporary for debug
+    int get_K_Vdd_EE() const {return K_Vdd_EE;}
+    int get_Vdd25_EE() const {return Vdd_25_EE;}
+    double get_a_PTAT() const {return a_PTAT;}
+    double get_K_V_PTAT() const {return K_V_PTAT;}
+    double get_K_T_PTAT() const {return K_T_PTAT;}
+    int get_V_PTAT_25() const {return V_PTAT_25;}
+
+    void print_ee(void) const;
+
+private:
+    bool read_ee(const char * path);
+    unsigned short fetch_EE_address(int address) const;
+    void build_plan(void);
+
+public:
+    // path: an EE dump, or a recording (recording.hpp) carrying one
+    bool init_ee(const char * path, bool ignore_ee_check);
+    // The 0x340 words as read, little endian
+    const uint16_t * ee_words(void) const { return ee.word_; }
+};
+
+#endif // __MLX90640_CALIBRATION_HPP__
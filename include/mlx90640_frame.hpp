@@ -0,0 +1,205 @@
+#ifndef __MLX90640_FRAME_HPP__
+#define __MLX90640_FRAME_HPP__
+
+#include <cstring>
+
+#include "memory_mlx90640.hpp"
+#include "mlx90640_calibration.hpp"
+#include "pixel_kernel.hpp"
+#include "fixed_kernel.hpp"
+
+// Per-frame state: the frame itself, its constants, and the results.
+// Reads the calibration only, so several contexts can process frames of the
+// same sensor at once, one context per thread.
+// With the 27-line format a frame only updates its own subpage of To[]; the
+// other half is whatever this context processed last. A fresh context needs
+// one frame of warm-up before its output matches a serial run.
+class mlx90640_frame {
+public:
+    explicit mlx90640_frame(const mlx90640_calibration & calib_) : calib(&calib_) {
+        view = nullptr;
+        extended = false;
+        subpage = 0;
+        counters = { 0, 0 };
+        kernel = select_pixel_kernel(nullptr);
+        root = ROOT_POW;
+        plan_folds = 0;
+        // The other subpage's half is read before the first frame writes it
+        memset(To, 0, sizeof(To));
+        memset(To_cK, 0, sizeof(To_cK));
+    }
+    // Copying takes the settings and the last results along, e.g. to start
+    // worker contexts from a warmed-up one.
+    ~mlx90640_frame() {}
+
+    const mlx90640_calibration & calibration() const { return *calib; }
+
+protected:
+    const mlx90640_calibration * calib;
+
+    mlx90640_ram_ ram;
+    // The frame being processed if not ram, see view_frame()
+    const mlx90640_ram_ * view;
+
+    const mlx90640_ram_ * frame() const { return view ? view : &ram; }
+
+    int VDD_raw;
+    int V_PTAT;
+    int V_BE;
+    int gain_ram;
+
+    bool extended;
+    int subpage;
+
+public: // temporary for debug
+    int get_VDD_raw() {return VDD_raw;}
+    int get_V_PTAT() {return V_PTAT;}
+    int get_V_BE() {return V_BE;}
+
+private:
+    unsigned short fetch_RAM_address(int address);
+    unsigned short fetch_reg_address(int address);
+
+public:
+    // Feed a frame that was read elsewhere, e.g. a recording already in memory.
+    void load_frame(const void * src) {
+        memcpy(ram.word_, src, extended ? 0x6c0 : 0x680);
+        view = nullptr;
+        parse_ram();
+    }
+
+    // Like load_frame(), minus the copy: src must stay valid and unchanged
+    // until the frame has been processed (copies of this context included).
+    void view_frame(const void * src) {
+        view = (const mlx90640_ram_ *)src;
+        parse_ram();
+    }
+
+    void set_extended(bool extended_) { extended = extended_; }
+
+protected:
+    void parse_ram(void) {
+        VDD_raw = frame()->named.VDD_raw;
+        V_PTAT = frame()->named.Ta_PTAT; // p18 says Ta_PTAT but p23 says V_PTAT
+        V_BE = frame()->named.V_BE;
+
+        gain_ram = frame()->named.ram_GAIN;
+    }
+
+public:
+
+    enum PIX_NOTE {
+        MIN_T,
+        MAX_T,
+        SCENE_CENTER
+    };
+
+    struct pixel {
+        int x;
+        int y;
+        double T;
+    };
+    typedef pixel notable_pxls_t[3];
+
+    // Pixels that fell outside 0..65535 when mapped to GRAY16 and got clamped.
+    // Only rounding should ever land here; kept as counters so the loop stays free of I/O.
+    struct map_counters {
+        unsigned long too_big;
+        unsigned long negative;
+    };
+
+private:
+    double dV;
+    double V_PTAT_art;
+    double dTa;
+    double gain;
+    double T_ar;
+    double e;
+
+    // The calibration plan with this frame's constants folded in, see fold_plan()
+    struct {
+        alignas(32) double scale[0x300];        // gain / a_ref
+        alignas(32) double bias[0x300];         // T_ar - offset compensation / a_ref
+
+        // scale/bias rounded to float, only kept up to date for single precision kernels
+        alignas(32) float scale_f[0x300];
+        alignas(32) float bias_f[0x300];
+    } folded;
+    unsigned long plan_folds;
+
+    double pix[0x300];
+    double To[0x300];
+
+    int32_t To_cK[0x300];
+    int32_t To_cK_min;
+    int32_t To_cK_max;
+
+    notable_pxls_t pix_list;
+    map_counters counters;
+
+    void fold_plan(void);
+    void find_notable(void);
+
+    pixel_kernel kernel;
+    root_method root;
+
+public:
+    // Pick the process_pixel() implementation, "auto" for CPU detection.
+    // single_precision trades accuracy for twice the SIMD width, see mlx90640_bench -a.
+    bool set_kernel(const char * name, bool single_precision = false) {
+        pixel_kernel k = select_pixel_kernel(name, single_precision);
+        if (k.fn == nullptr)
+            return false;
+        kernel = k;
+        return true;
+    }
+    const char * kernel_name() { return kernel.name; }
+    bool kernel_single_precision() { return kernel.single_precision; }
+
+    // Fourth root used by the kernels, see fourth_root.hpp for the error bounds.
+    void set_root(root_method root_) { root = root_; }
+    root_method root_() { return root; }
+    // What the kernel evaluates for it: the vector kernels take pow as sqrt
+    root_method root_used() { return kernel_root(kernel, root); }
+
+    void process_frame(void);
+    void process_pixel(void);
+    // The datasheet formula evaluated directly, without the plan or any kernel.
+    // Slow; kept as the reference for the optimized paths.
+    void process_pixel_reference(void);
+    // Integer-only alternative to process_pixel(); fills To_cK_() instead of To_().
+    // pix_notable() is filled either way. Per pixel there is no floating
+    // point at all: the plan is only folded for process_pixel().
+    void process_pixel_fixed(void);
+
+    // process_pixel() / process_pixel_fixed(), then min-max map the frame to
+    // GRAY16 straight into dest (0x300 pixels) while To[] is still in cache.
+    void process_pixel_gray16(uint16_t * dest) {
+        process_pixel();
+        map_gray16(dest);
+    }
+    void process_pixel_fixed_gray16(uint16_t * dest) {
+        process_pixel_fixed();
+        map_gray16_fixed(dest);
+    }
+    // The mapping step alone, on the last process_pixel() / process_pixel_fixed()
+    void map_gray16(uint16_t * dest);
+    void map_gray16_fixed(uint16_t * dest);
+    const map_counters & map_counters_() { return counters; }
+    // How often the plan was folded (once per process_pixel()), for checks
+    unsigned long plan_folds_() { return plan_folds; }
+
+    // Sensor ambient temperature (degC) and supply (V) of the last process_frame()
+    double Ta_() { return dTa + 25.0; }
+    double Vdd_() { return dV + 3.3; }
+
+    const double * To_() { return To; }
+    const int32_t * To_cK_() { return To_cK; }
+    int32_t To_cK_min_() { return To_cK_min; }
+    int32_t To_cK_max_() { return To_cK_max; }
+    const uint16_t * Pix_Raw_() { return frame()->word_; }
+    const notable_pxls_t * pix_notable() { return &pix_list; }
+
+};
+
+#endif // __MLX90640_FRAME_HPP__
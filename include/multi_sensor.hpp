@@ -0,0 +1,48 @@
+#ifndef __MULTI_SENSOR_HPP__
+#define __MULTI_SENSOR_HPP__
+
+#include <vector>
+
+#include "fourth_root.hpp"
+#include "push_data.hpp"
+
+struct sensor_source {
+    const char * dev_name;
+    const char * nv_name;
+};
+
+// Shared by all sensors; the same meaning as the single-sensor options
+struct multi_sensor_config {
+    int io_method;
+    int fps;
+    bool extended_format;
+    bool ignore_ee_check;
+    int buf_count;
+    bool latest_only;
+    double start;           // --start, 0 to replay from the first frame
+
+    const char * kernel_name;
+    bool single_precision;
+    root_method root;
+    bool fixed_point;
+
+    int interp_type;
+    int interp_ratio;
+    // A file sink writes PATH.n too
+    gst_sink_config sink;
+
+    // nullptr: not saving, else sensor n saves to PATH.n
+    const char * save_path;
+    const char * save_raw_path;
+    bool compress_raw;      // --save-raw in the raw_codec.hpp format
+    const char * record_path;   // --record, see recording.hpp
+};
+
+// Drives every source from one thread: V4L2 fds, and timerfds pacing the
+// raw files, on a single epoll loop. Each sensor keeps its own calibration
+// and its own output pipeline. Returns once all sources are done, or
+// exits on setup errors like the single-sensor path does.
+void run_multi_sensor(const std::vector<sensor_source> & sources,
+                      const multi_sensor_config & config);
+
+#endif // __MULTI_SENSOR_HPP__
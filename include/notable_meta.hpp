@@ -0,0 +1,27 @@
+#ifndef __NOTABLE_META_HPP__
+#define __NOTABLE_META_HPP__
+
+#include <gst/gst.h>
+
+#include "mlx90640.hpp"
+
+// The min/max/center pixels of a frame, on the GRAY16 buffer that carries
+// the frame. x and y are sensor pixels (32x24) and T is in degrees C, so
+// the meta stays valid through scaling and color conversion; it has no
+// tags and elements copy it along.
+struct notable_meta {
+    GstMeta meta;
+    mlx90640::notable_pxls_t pix;
+};
+
+GType notable_meta_api_get_type(void);
+const GstMetaInfo * notable_meta_get_info(void);
+#define NOTABLE_META_API_TYPE (notable_meta_api_get_type())
+#define NOTABLE_META_INFO (notable_meta_get_info())
+
+// buffer must be writable
+notable_meta * buffer_add_notable_meta(GstBuffer * buffer, const mlx90640::notable_pxls_t * pix);
+// NULL if the buffer has none
+const notable_meta * buffer_get_notable_meta(GstBuffer * buffer);
+
+#endif // __NOTABLE_META_HPP__
@@ -0,0 +1,56 @@
+#ifndef __OVERLAY_HPP__
+#define __OVERLAY_HPP__
+
+#include <cstdint>
+#include <vector>
+
+#include "mlx90640.hpp"
+
+// A part of the frame, in frame pixels
+struct overlay_region {
+    int x, y, w, h;
+};
+
+// Draws the MAX/MIN/MID readouts and the scene-center crosshair, on the
+// CPU, into small images of their own that the display composites onto the
+// heat map. The glyphs (a 5x7 font) and the crosshair are rasterized once,
+// at the size of the frame, into masks; drawing is then a copy of the set
+// mask pixels, opaque white with a black outline.
+class overlay_renderer {
+public:
+    // The frame is 32 * scale_ratio by 24 * scale_ratio pixels
+    explicit overlay_renderer(int scale_ratio);
+
+    // Where each part goes in the frame, and the size of its image
+    overlay_region cross_region(void) const;
+    overlay_region text_region(void) const;
+
+    // Into a zeroed 4 byte per pixel image of the region, alpha last as in
+    // RGBA or BGRA; pixels not drawn stay transparent. stride in bytes.
+    void draw_cross(uint8_t * pixels, int stride) const;
+    void draw_text(uint8_t * pixels, int stride, const mlx90640::notable_pxls_t & pix) const;
+
+private:
+    int width, height;
+
+    // Mask values
+    enum { CLEAR = 0, OUTLINE = 1, FILL = 2 };
+
+    // One cell per glyph, side by side: cell_w * glyph_count by cell_h
+    int cell_w, cell_h;
+    std::vector<uint8_t> atlas;
+
+    // One sensor pixel, the size of the former gloverlay image
+    int cross_size;
+    std::vector<uint8_t> cross;
+
+    void rasterize_glyphs(int s);
+    void rasterize_cross(void);
+    // x0, y0 in the frame, clipped to the region the image is of
+    void blit(uint8_t * pixels, int stride, const overlay_region & r,
+              const uint8_t * mask, int mask_stride, int w, int h, int x0, int y0) const;
+    void text(uint8_t * pixels, int stride, const overlay_region & r,
+              const char * str, int x0, int y0) const;
+};
+
+#endif // __OVERLAY_HPP__
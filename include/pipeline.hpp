@@ -0,0 +1,46 @@
+#ifndef __PIPELINE_HPP__
+#define __PIPELINE_HPP__
+
+#include <cstdio>
+
+#include "mlx90640.hpp"
+#include "dev_handler.hpp"
+#include "metrics.hpp"
+#include "recorder.hpp"
+
+// Depth of the capture -> compute and compute -> output rings, in frames
+#define PIPELINE_RAW_SLOTS 4
+#define PIPELINE_OUT_SLOTS 4
+
+struct pipeline_config {
+    bool fixed_point;
+
+    // nullptr: not saving; else started, and fed from the output thread
+    recorder * rec;
+
+    // nullptr: metrics off; else updated live from all three threads
+    sensor_metrics * metrics;
+};
+
+struct pipeline_stats {
+    unsigned long captured;
+    unsigned long capture_drops;    // compute fell behind, raw ring full
+    unsigned long compute_drops;    // output fell behind, output ring full
+    unsigned long output;
+};
+
+// The main loop, split over three threads:
+//     capture  read_frame_file() into the raw ring
+//     compute  process_frame() and the GRAY16 mapping, straight into a pool
+//              buffer (gst_map_frame()) passed on through the output ring
+//     output   queueing for --save and gst_push_frame(), on the calling thread
+// so a slow sink no longer holds up dequeuing from the sensor.
+// With a device, a full ring drops the new frame and counts it; a raw file
+// is replayed without drops.
+// mlx must be set up with init_frame_file(device, false): frames are
+// copied into the raw ring, the driver's buffer is not held.
+// Returns when the source runs out or the sink fails.
+pipeline_stats run_pipeline(mlx90640 & mlx, dev_handler * device,
+                            const pipeline_config & config);
+
+#endif // __PIPELINE_HPP__
@@ -0,0 +1,63 @@
+#ifndef __PIXEL_KERNEL_HPP__
+#define __PIXEL_KERNEL_HPP__
+
+#include <cstdint>
+
+#include "fourth_root.hpp"
+
+// Everything the per-pixel compensation needs for one frame.
+// scale[] and bias[] are the calibration plan with this frame's constants
+// folded in (see mlx90640::fold_plan()), so per pixel it is only
+//     To = (raw * scale + bias) ^ 0.25 - 273.15
+// The kernel only writes To[], and only the pixels of the active subpage.
+// Single precision kernels read scale_f[]/bias_f[] instead, the same plan
+// rounded to float, and widen to double only for the final - 273.15.
+struct pixel_kernel_args {
+    const int16_t * ram_PIX;
+    const double * scale;
+    const double * bias;
+    const float * scale_f;
+    const float * bias_f;
+
+    bool extended;
+    int subpage;
+
+    root_method root;
+
+    double * To;
+};
+
+typedef void (*pixel_kernel_fn)(const pixel_kernel_args &);
+
+struct pixel_kernel {
+    const char * name;
+    pixel_kernel_fn fn;
+    bool single_precision;
+    bool has_pow;           // false: ROOT_POW runs as ROOT_SQRT
+};
+
+// The fourth root k actually evaluates when asked for r
+static inline root_method kernel_root(const pixel_kernel & k, root_method r) {
+    return r == ROOT_POW && !k.has_pow ? ROOT_SQRT : r;
+}
+
+// Plain C++ loop. Always available, and the reference the others are checked against.
+void pixel_kernel_scalar(const pixel_kernel_args & args);
+void pixel_kernel_scalar_f32(const pixel_kernel_args & args);
+
+#if defined(__x86_64__) || defined(__i386__)
+void pixel_kernel_sse4(const pixel_kernel_args & args);
+void pixel_kernel_sse4_f32(const pixel_kernel_args & args);
+void pixel_kernel_avx2(const pixel_kernel_args & args);
+void pixel_kernel_avx2_f32(const pixel_kernel_args & args);
+#endif
+#if defined(__aarch64__)
+void pixel_kernel_neon(const pixel_kernel_args & args);
+void pixel_kernel_neon_f32(const pixel_kernel_args & args);
+#endif
+
+// name == nullptr or "auto": best kernel the running CPU supports.
+// Returns {nullptr, nullptr, false, false} if the name is unknown or not supported here.
+pixel_kernel select_pixel_kernel(const char * name, bool single_precision = false);
+
+#endif // __PIXEL_KERNEL_HPP__
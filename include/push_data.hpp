@@ -4,10 +4,66 @@
 #include <cstdint>
 #include "mlx90640.hpp"
 
+// Where the frames go. All but SINK_DISPLAY run without GL or a display;
+// they get the bare GRAY16 frames, no scaling and no text. Every frame
+// carries its notable pixels as a notable_meta (notable_meta.hpp).
+enum gst_sink_type {
+    SINK_DISPLAY,       // videoscale, GL heat map and overlays, glimagesink
+    SINK_FAKE,          // fakesink, for measuring everything before it
+    SINK_FILE,          // filesink at path, the same format as --save
+    SINK_CALLBACK       // appsink, callback() on its streaming thread
+};
+
+struct gst_sink_config {
+    gst_sink_type type;
+    const char * path;
+    // notable: from the frame's notable_meta, NULL if it had none
+    void (*callback)(const uint16_t * gray16, const mlx90640::notable_pxls_t * notable, void * user);
+    void * user;
+};
+
+// "display", "fake" or "file:PATH"; a callback can only be set from code.
+bool parse_sink(const char * spec, gst_sink_config * sink);
+
+// One appsrc -> sink pipeline per stream, so several sensors can share
+// a process. gst_stream_new() initializes GStreamer on first use and
+// returns NULL on failure.
+typedef struct _CustomData gst_stream;
+
+// sink == NULL: SINK_DISPLAY
+gst_stream * gst_stream_new(int scale_type, int scale_ratio, const gst_sink_config * sink = NULL);
+void gst_stream_start(gst_stream * stream);
+// The next frame goes straight into the buffer this returns, one from a
+// pool negotiated with downstream once the stream is started; the same
+// buffer until it is armed. NULL when no buffer could be had.
+uint8_t * gst_stream_get_userp(gst_stream * stream);
+bool gst_stream_arm_buffer(gst_stream * stream, const mlx90640::notable_pxls_t * const pix_list);
+// Frames gst_stream_arm_buffer() discarded because GStreamer asked us to stop
+// feeding (enough-data); read it from the thread that arms the buffers.
+unsigned long gst_stream_dropped(gst_stream * stream);
+void gst_stream_free(gst_stream * stream);
+
+// The same, for a frame filled on one thread and pushed from another, as
+// run_pipeline() does: any number may be mapped at once. A frame holds
+// one pool buffer at a time, mapped until it is pushed; map it again for
+// the next. With a bounded downstream pool, mapping waits for a buffer.
+struct gst_frame;
+gst_frame * gst_frame_new(void);
+// Gives back a buffer still held
+void gst_frame_free(gst_frame * frame);
+// NULL when no buffer could be had
+uint8_t * gst_stream_map_frame(gst_stream * stream, gst_frame * frame);
+bool gst_stream_push_frame(gst_stream * stream, gst_frame * frame,
+                           const mlx90640::notable_pxls_t * const pix_list);
+
+// The same for a single, process-wide stream
 uint8_t * gst_get_userp(void);
 bool gst_arm_buffer(const mlx90640::notable_pxls_t * const pix_list);
+unsigned long gst_dropped(void);
+uint8_t * gst_map_frame(gst_frame * frame);
+bool gst_push_frame(gst_frame * frame, const mlx90640::notable_pxls_t * const pix_list);
 
-int gst_init_(int, int);
+int gst_init_(int, int, const gst_sink_config * sink = NULL);
 void gst_start_running(void);
 void gst_cleanup(void);
 
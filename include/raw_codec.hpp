@@ -0,0 +1,78 @@
+#ifndef __RAW_CODEC_HPP__
+#define __RAW_CODEC_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Lossless compressed --save-raw recordings. A file is a rawz_header, then
+// one record per frame:
+//     uint32_t  payload bytes, bit 31 set for a keyframe (little endian)
+//     payload   the frame's residuals, Rice coded
+// Each word is predicted from the same word of the previous frame, or on a
+// keyframe from the word before it; the residual is zigzag mapped and Rice
+// coded, with k picked per block of RAWZ_BLOCK words (4 bits up front).
+// Keyframes come every keyframe_interval frames, so a reader can start at
+// any of them. Most of a frame is the same as the last one (the other
+// subpage, the registers) or noise around it, which takes 1-4 bits a word.
+
+#define RAWZ_MAGIC "MLXRAWZ1"
+#define RAWZ_KEYFRAME_INTERVAL 64
+#define RAWZ_BLOCK 32
+
+// All little endian
+struct rawz_header {
+    char magic[8];
+    uint16_t words;                 // per frame, 0x340 or 0x360
+    uint16_t keyframe_interval;
+    uint32_t reserved;
+};
+
+#define RAWZ_RECORD_HEADER 4
+#define RAWZ_KEYFRAME 0x80000000u
+
+class raw_encoder {
+public:
+    explicit raw_encoder(size_t words, unsigned keyframe_interval = RAWZ_KEYFRAME_INTERVAL);
+
+    // The file header, sizeof(rawz_header) bytes
+    void header(uint8_t * dest) const;
+    // Worst case of one encode()
+    size_t max_record_bytes(void) const;
+    // Appends the record for frame (little endian words) at dest,
+    // returns its size. dest must hold max_record_bytes().
+    size_t encode(const uint16_t * frame, uint8_t * dest);
+
+private:
+    size_t words;
+    unsigned keyframe_interval;
+    unsigned long frames;
+    std::vector<uint16_t> prev;
+    std::vector<uint16_t> residual;
+};
+
+class raw_decoder {
+public:
+    raw_decoder();
+
+    // Whether data starts with a rawz_header
+    static bool probe(const void * data, size_t length);
+
+    // data stays owned by the caller, and must outlive the decoder
+    bool open(const void * data, size_t length);
+    size_t words(void) const { return n_words; }
+
+    // The next frame into dest, as little endian words like a raw file.
+    // false at the end of the data, or on a damaged record (printed).
+    bool decode(uint16_t * dest);
+
+private:
+    const uint8_t * data;
+    size_t length;
+    size_t pos;
+    size_t n_words;
+    bool have_prev;
+    std::vector<uint16_t> prev;
+};
+
+#endif // __RAW_CODEC_HPP__
@@ -0,0 +1,106 @@
+#ifndef __RECORDER_HPP__
+#define __RECORDER_HPP__
+
+#include <atomic>
+#include <thread>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "spsc_ring.hpp"
+#include "raw_codec.hpp"
+#include "recording.hpp"
+
+// Queue depth, a power of two: about 0.8 MiB, 4 s at 64 fps
+#define RECORDER_SLOTS 256
+// Most frames per pwritev(), each one iovec per file
+#define RECORDER_BATCH 64
+
+struct recorder_config {
+    // nullptr: not written
+    const char * gray_path;     // GRAY16 frames (--save)
+    const char * raw_path;      // raw_words of RAM per frame (--save-raw)
+    const char * record_path;   // recording.hpp container (--record)
+
+    size_t raw_words;           // 0x340 or 0x360
+    bool compress_raw;          // raw_path in the raw_codec.hpp format
+    const uint16_t * ee;        // for record_path, 0x340 words
+    int fps;                    // for record_path, -1 if not set
+    // On a full queue drop and count the frame rather than wait, for a
+    // live device; a replayed file loses nothing
+    bool drop;
+};
+
+struct recorder_stats {
+    unsigned long frames;       // queued for writing
+    unsigned long overflows;    // dropped on a full queue
+    unsigned long errors;       // files that failed to write, each reported once
+};
+
+// --save, --save-raw and --record, written from a thread of its own so a
+// slow disk does not hold up the frame loop. Frames are copied into a
+// bounded queue of preallocated slots and written out in batches with
+// pwritev(); compression and the container index are done there too.
+//     recorder rec;
+//     rec.start(config);
+//     rec.record(gray16, raw, recording_now());    // per frame
+//     rec.stop();
+class recorder {
+public:
+    recorder();
+    ~recorder();
+
+    recorder(const recorder &) = delete;
+    recorder & operator=(const recorder &) = delete;
+
+    // false on errors, with the reason printed
+    bool start(const recorder_config & config);
+    bool active(void) const { return ring != nullptr; }
+
+    // false if the frame was dropped. Never waits with drop set.
+    // timestamp_ns: when the frame was read, see recording_now()
+    bool record(const uint16_t * gray16, const uint16_t * raw, int64_t timestamp_ns);
+
+    // Writes out what is queued and the container index, stops the thread
+    // and closes the files
+    recorder_stats stop(void);
+
+private:
+    struct slot {
+        uint16_t gray[0x300];
+        uint16_t raw[0x360];
+        int64_t timestamp;
+    };
+
+    struct output {
+        int fd;
+        off_t offset;
+        size_t slot_offset;     // of the data within a slot
+        size_t frame_bytes;
+        const char * path;
+        raw_encoder * encoder;  // nullptr: frames are written as they are
+    };
+
+    spsc_ring<slot, RECORDER_SLOTS> * ring;
+    std::thread writer;
+    output gray_out, raw_out, rec_out;
+    bool drop;
+    // Encoded records of one batch
+    std::vector<uint8_t> packed;
+    // Of rec_out, written at the end
+    std::vector<rec_index_entry> index;
+
+    std::atomic<unsigned long> frames;
+    std::atomic<unsigned long> overflows;
+    std::atomic<unsigned long> errors;
+
+    bool write_prefix(output & out, const void * data, size_t bytes);
+    void write_index(void);
+    void close_outputs(void);
+    void write_loop(void);
+    void write_batch(output & out, size_t n);
+};
+
+#endif // __RECORDER_HPP__
@@ -0,0 +1,110 @@
+#ifndef __RECORDING_HPP__
+#define __RECORDING_HPP__
+
+#include <cstddef>
+#include <cstdint>
+
+// Self-contained recordings (--record). All little endian:
+//     rec_header          REC_HEADER_BYTES
+//     EE dump             0x340 words, as --nvram reads them
+//     frames              header.words each, back to back from REC_DATA_OFFSET
+//     rec_index_entry     one per frame
+//     rec_footer          at the very end
+// The index and footer are written when recording stops. A recording cut
+// short without them still replays: the frames are counted from the file
+// size, only their timestamps are lost.
+
+#define REC_MAGIC "MLXREC01"
+#define REC_INDEX_MAGIC "MLXIDX01"
+
+struct rec_header {
+    char magic[8];
+    uint16_t words;             // per frame, 0x340 or 0x360
+    uint16_t ee_words;          // 0x340
+    int32_t fps;                // --fps at recording time, -1 if not set
+    int64_t created_ns;         // CLOCK_REALTIME
+    uint8_t reserved[40];
+};
+
+struct rec_index_entry {
+    uint64_t offset;            // of the frame, from the start of the file
+    int64_t timestamp_ns;       // CLOCK_REALTIME when the frame was read
+};
+
+struct rec_footer {
+    char magic[8];
+    uint64_t frames;
+    uint64_t index_offset;
+    uint64_t reserved;
+};
+
+#define REC_HEADER_BYTES 64
+#define REC_EE_OFFSET REC_HEADER_BYTES
+#define REC_DATA_OFFSET (REC_EE_OFFSET + 0x340 * 2)
+
+static_assert(sizeof(rec_header) == REC_HEADER_BYTES, "rec_header layout");
+static_assert(sizeof(rec_index_entry) == 16, "rec_index_entry layout");
+static_assert(sizeof(rec_footer) == 32, "rec_footer layout");
+
+// CLOCK_REALTIME in ns, what the index stores
+int64_t recording_now(void);
+
+// Whether the file at path starts with a rec_header
+bool recording_probe(const char * path);
+
+// Read side. The file is mapped whole: frame n is at a fixed offset, found
+// in O(1). A time is guessed from the mean frame period over the index and
+// the guess corrected from there, which is O(1) at a steady frame rate and
+// O(log d) when gaps or drops put the guess d frames off. Nothing is
+// modified after open(), so any number of threads may read ranges at once.
+class recording {
+public:
+    recording();
+    ~recording();
+
+    recording(const recording &) = delete;
+    recording & operator=(const recording &) = delete;
+
+    // false with the reason printed
+    bool open(const char * path);
+
+    size_t words(void) const { return n_words; }
+    bool extended(void) const { return n_words == 0x360; }
+    int fps(void) const { return rec_fps; }
+    // 0x340 words, little endian
+    const uint16_t * ee(void) const { return (const uint16_t *)(map + REC_EE_OFFSET); }
+
+    unsigned long frames(void) const { return n_frames; }
+    // false if the recording was cut short and has no index
+    bool indexed(void) const { return index != nullptr; }
+    // 0 without an index
+    int64_t timestamp(unsigned long n) const;
+    // Of the first frame, or when recording started without an index
+    int64_t start_time(void) const { return indexed() ? timestamp(0) : created_ns; }
+    // The first frame read at or after t, frames() if there is none.
+    // Without an index, estimated from the header's fps.
+    // Timestamps are CLOCK_REALTIME: a clock step back while recording
+    // leaves them out of order, and the frame found is then only near t.
+    unsigned long seek_time(int64_t t) const;
+
+    // Into the mapping, valid as long as the recording is open
+    const void * frame_ptr(unsigned long n) const {
+        return map + REC_DATA_OFFSET + n * n_words * 2;
+    }
+    // Frames [first, first + count) into dest with pread(), bypassing
+    // the mapping; false past the end or on read errors
+    bool read_frames(unsigned long first, unsigned long count, void * dest) const;
+
+private:
+    int fd;
+    const uint8_t * map;
+    size_t length;
+
+    size_t n_words;
+    int rec_fps;
+    int64_t created_ns;
+    unsigned long n_frames;
+    const rec_index_entry * index;
+};
+
+#endif // __RECORDING_HPP__
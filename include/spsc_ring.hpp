@@ -0,0 +1,120 @@
+#ifndef __SPSC_RING_HPP__
+#define __SPSC_RING_HPP__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Bounded single-producer/single-consumer ring of preallocated slots.
+//
+// Slots are filled and read in place, nothing is copied in or out:
+//     producer: T * s = claim();  fill *s;  publish();
+//     consumer: T * s = peek();   use *s;   consume();
+// A consumer can also take several at once: peek_at(0 .. ready() - 1),
+// then consume(n).
+// The *_wait() variants sleep (futex via std::atomic::wait) instead of
+// failing, and return nullptr once the ring is closed: the producer as soon
+// as close() is called, the consumer only after draining what is left.
+template<typename T, size_t N>
+class spsc_ring {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "N must be a power of two");
+
+    // Written by the producer only
+    alignas(64) std::atomic<size_t> head;
+    // Written by the consumer only
+    alignas(64) std::atomic<size_t> tail;
+
+    // Wait words; bumped after each publish()/consume() and by close(),
+    // so a sleeper also wakes up for the latter.
+    alignas(64) std::atomic<uint32_t> published;
+    alignas(64) std::atomic<uint32_t> consumed;
+    std::atomic<bool> closed;
+
+    T slots[N];
+
+public:
+    spsc_ring() : head(0), tail(0), published(0), consumed(0), closed(false) {}
+
+    spsc_ring(const spsc_ring &) = delete;
+    spsc_ring & operator=(const spsc_ring &) = delete;
+
+    // Producer side
+    T * claim() {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == N)
+            return nullptr;
+        return &slots[h & (N - 1)];
+    }
+
+    T * claim_wait() {
+        for (;;) {
+            uint32_t ev = consumed.load(std::memory_order_acquire);
+            if (closed.load(std::memory_order_acquire))
+                return nullptr;
+            T * slot = claim();
+            if (slot)
+                return slot;
+            consumed.wait(ev, std::memory_order_acquire);
+        }
+    }
+
+    void publish() {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        published.fetch_add(1, std::memory_order_release);
+        published.notify_one();
+    }
+
+    // Consumer side
+    T * peek() {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (head.load(std::memory_order_acquire) == t)
+            return nullptr;
+        return &slots[t & (N - 1)];
+    }
+
+    T * peek_wait() {
+        for (;;) {
+            uint32_t ev = published.load(std::memory_order_acquire);
+            // closed is read before the ring so nothing published
+            // ahead of close() is missed
+            bool was_closed = closed.load(std::memory_order_acquire);
+            T * slot = peek();
+            if (slot)
+                return slot;
+            if (was_closed)
+                return nullptr;
+            published.wait(ev, std::memory_order_acquire);
+        }
+    }
+
+    // Published slots not consumed yet
+    size_t ready() {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+    }
+
+    // i < ready()
+    T * peek_at(size_t i) {
+        return &slots[(tail.load(std::memory_order_relaxed) + i) & (N - 1)];
+    }
+
+    void consume(size_t n = 1) {
+        tail.store(tail.load(std::memory_order_relaxed) + n, std::memory_order_release);
+        consumed.fetch_add(1, std::memory_order_release);
+        consumed.notify_one();
+    }
+
+    bool is_closed() {
+        return closed.load(std::memory_order_acquire);
+    }
+
+    // Either side, any thread: no more frames will come or be taken.
+    void close() {
+        closed.store(true, std::memory_order_release);
+        published.fetch_add(1, std::memory_order_release);
+        published.notify_all();
+        consumed.fetch_add(1, std::memory_order_release);
+        consumed.notify_all();
+    }
+};
+
+#endif // __SPSC_RING_HPP__
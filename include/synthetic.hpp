@@ -0,0 +1,39 @@
+#ifndef __SYNTHETIC_HPP__
+#define __SYNTHETIC_HPP__
+
+#include <cstdint>
+
+#include "memory_mlx90640.hpp"
+
+// A made-up but self-consistent MLX90640: an EE image that passes the
+// MLX_ID/REG_CONF_EE check and decodes to plausible constants, and frames
+// of a 25 degC scene with a 65 degC hot spot wandering over it, as the
+// sensor would report them with that EE. For benchmarks and tests that must
+// run without hardware or a recording.
+// Deterministic for a given seed.
+class synthetic_sensor {
+public:
+    explicit synthetic_sensor(uint32_t seed = 1);
+    ~synthetic_sensor() {}
+
+private:
+    uint32_t seed;
+    mlx90640_nvmem_ ee;         // as read from the device, little endian
+    int offset[0x300];          // offset_ref the EE decodes to
+
+    double gauss(uint32_t & state) const;
+
+public:
+    const mlx90640_nvmem_ & ee_image(void) const { return ee; }
+
+    // Frame n of the scene: 0x340 words, or 0x360 with the extended
+    // (27-line) format, where the subpages alternate starting with 0.
+    void frame(unsigned long n, bool extended, uint16_t * dest) const;
+
+    // Write the EE as a NVRAM dump, and n frames as a --save-raw recording.
+    // false with errno set on errors.
+    bool write_ee(const char * path) const;
+    bool write_recording(const char * path, unsigned long n, bool extended) const;
+};
+
+#endif // __SYNTHETIC_HPP__
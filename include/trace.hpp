@@ -0,0 +1,67 @@
+#ifndef __TRACE_HPP__
+#define __TRACE_HPP__
+
+// Hot-path tracing, built in with `meson configure -Dtrace=true` (MLX_TRACE).
+// Every thread records the begin/end of its stages into a ring of its own,
+// TRACE_RING_EVENTS long, overwriting the oldest. The rings are written as
+// Chrome trace JSON (chrome://tracing, ui.perfetto.dev) on SIGUSR1 and at
+// exit, to $MLX90640_TRACE or else ./mlx90640_trace.json.
+// Without MLX_TRACE the macros expand to nothing.
+//
+//     TRACE_SCOPE("process_pixel");   // from here to the end of the block
+
+#ifdef MLX_TRACE
+
+#include <cstdint>
+#include <time.h>
+
+#define TRACE_RING_EVENTS 65536     // per thread, a power of two
+
+// Once, early in main(): the SIGUSR1 handler and the dump at exit
+void trace_init(void);
+// Label the calling thread in the trace
+void trace_thread_name(const char * name);
+// The dump for SIGUSR1 is done here, outside the signal handler.
+// Call it from a thread that loops anyway.
+void trace_poll(void);
+// name must be a string literal, or live as long as the process
+void trace_record(const char * name, uint64_t begin_ns, uint64_t end_ns);
+bool trace_dump(const char * path);
+
+static inline uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+class trace_scope {
+public:
+    explicit trace_scope(const char * name_) : name(name_), begin(trace_now()) {}
+    ~trace_scope() { trace_record(name, begin, trace_now()); }
+
+    trace_scope(const trace_scope &) = delete;
+    trace_scope & operator=(const trace_scope &) = delete;
+
+private:
+    const char * name;
+    uint64_t begin;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#define TRACE_INIT() trace_init()
+#define TRACE_THREAD_NAME(name) trace_thread_name(name)
+#define TRACE_POLL() trace_poll()
+#define TRACE_SCOPE(name) trace_scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+#else
+
+#define TRACE_INIT() do {} while (0)
+#define TRACE_THREAD_NAME(name) do {} while (0)
+#define TRACE_POLL() do {} while (0)
+#define TRACE_SCOPE(name) do {} while (0)
+
+#endif // MLX_TRACE
+
+#endif // __TRACE_HPP__
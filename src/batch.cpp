@@ -0,0 +1,140 @@
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "batch.hpp"
+#include "dev_handler.hpp"
+#include "trace.hpp"
+
+#define GRAY16_BYTES (0x300 * sizeof(uint16_t))
+
+struct batch_job {
+    const mlx90640_frame * proto;
+    bool fixed_point;
+
+    dev_handler * source;
+    int out_fd;
+    unsigned long frames;
+    unsigned long chunk_frames;
+
+    std::atomic<unsigned long> next_chunk;
+    std::atomic<bool> failed;
+
+    std::mutex lock;
+    mlx90640_frame::map_counters counters;
+};
+
+static void batch_worker(batch_job & job) {
+    std::vector<uint16_t> out(job.chunk_frames * 0x300);
+    TRACE_THREAD_NAME("batch");
+
+    while (!job.failed) {
+        TRACE_SCOPE("chunk");
+        unsigned long first = job.next_chunk++ * job.chunk_frames;
+        if (first >= job.frames)
+            break;
+        unsigned long last = std::min(first + job.chunk_frames, job.frames);
+
+        // Fresh per chunk: chunk 0 starts exactly like a serial run,
+        // the others are warmed up on the frame before.
+        mlx90640_frame * ctx = new mlx90640_frame(*job.proto);
+        // A recording container knows its line count, -X or not
+        ctx->set_extended(job.source->is_extended());
+        mlx90640_frame::map_counters before = ctx->map_counters_();
+
+        for (unsigned long n = first > 0 ? first - 1 : 0; n < last; n++) {
+            ctx->view_frame(job.source->frame_ptr(n));
+            ctx->process_frame();
+
+            if (n < first) {
+                // warm-up: only To[] matters
+                if (job.fixed_point)
+                    ctx->process_pixel_fixed();
+                else
+                    ctx->process_pixel();
+                continue;
+            }
+
+            uint16_t * dest = &out[(n - first) * 0x300];
+            if (job.fixed_point)
+                ctx->process_pixel_fixed_gray16(dest);
+            else
+                ctx->process_pixel_gray16(dest);
+        }
+
+        if (!job.failed) {
+            size_t bytes = (last - first) * GRAY16_BYTES;
+            if (pwrite(job.out_fd, out.data(), bytes, first * GRAY16_BYTES) != (ssize_t)bytes) {
+                fprintf(stderr, "Batch: write error %d, %s\n", errno, strerror(errno));
+                job.failed = true;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(job.lock);
+            job.counters.too_big += ctx->map_counters_().too_big - before.too_big;
+            job.counters.negative += ctx->map_counters_().negative - before.negative;
+        }
+        delete ctx;
+    }
+}
+
+bool run_batch(const mlx90640_frame & proto, const batch_config & config,
+               batch_stats * stats) {
+    batch_job job;
+
+    job.proto = &proto;
+    job.fixed_point = config.fixed_point;
+    job.chunk_frames = config.chunk_frames ? config.chunk_frames : BATCH_CHUNK_FRAMES;
+    job.next_chunk = 0;
+    job.failed = false;
+    job.counters = { 0, 0 };
+
+    // Read-only after this, the workers only call frame_ptr()
+    dev_handler source(dev_handler::IO_METHOD_READ, -1, config.extended);
+    source.init_frame_file(config.in_path);
+    if (source.is_device() || source.frame_count() == 0) {
+        fprintf(stderr, "Batch mode needs an uncompressed raw recording, '%s' is not one\n",
+                config.in_path);
+        return false;
+    }
+    job.source = &source;
+    job.frames = source.frame_count();
+
+    job.out_fd = open(config.out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (job.out_fd == -1) {
+        fprintf(stderr, "Cannot open '%s': %d, %s\n",
+                config.out_path, errno, strerror(errno));
+        return false;
+    }
+
+    unsigned jobs = config.jobs ? config.jobs : std::thread::hardware_concurrency();
+    if (jobs == 0)
+        jobs = 1;
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < jobs; i++)
+        workers.emplace_back(batch_worker, std::ref(job));
+    for (std::thread & t : workers)
+        t.join();
+
+    auto end = std::chrono::steady_clock::now();
+
+    close(job.out_fd);
+
+    stats->frames = job.frames;
+    stats->seconds = std::chrono::duration<double>(end - start).count();
+    stats->counters = job.counters;
+    return !job.failed;
+}
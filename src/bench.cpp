@@ -0,0 +1,1232 @@
+#include <iostream>
+#include <cstdio>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include <errno.h>
+#include <endian.h>
+#include <getopt.h>     /* getopt_long() */
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "mlx90640.hpp"
+#include "dev_handler.hpp"
+#include "pixel_kernel.hpp"
+#include "synthetic.hpp"
+#include "raw_codec.hpp"
+#include "recorder.hpp"
+#include "recording.hpp"
+
+// Microbenchmark for the compensation chain.
+// Loads a recording (as written by --save-raw) into memory, then times
+// process_frame() + process_pixel() per frame for every pixel kernel,
+// against the unplanned datasheet formula (process_pixel_reference()).
+// With -a, reports how far each kernel's To[] strays from that reference instead.
+// With -r, only the fourth root is measured, over the sensor's temperature range.
+// With -s, each stage of the frame path is timed on its own, with warm and
+// with cold caches, optionally as JSON (-j) for comparing builds.
+// With -G, a synthetic sensor and recordings stand in for -d/-n, so it all
+// runs anywhere; this is what the meson benchmarks use.
+// With -g, every path is checked pixel by pixel against golden vectors, and
+// the exit status tells whether they stayed within -b; -w records them.
+// With -e, a --record container is written through the recorder and read
+// back: frames, EE, timestamps and seek_time(), on both frame formats.
+
+static const char short_options[] = "d:n:hCXi:ab:rsjGg::w:e";
+
+static const struct option
+long_options[] = {
+    { "device",     required_argument,  NULL, 'd' },
+    { "nvram",      required_argument,  NULL, 'n' },
+    { "help",       no_argument,        NULL, 'h' },
+    { "ignore-EE-check",  no_argument,  NULL, 'C' },
+    { "extended-format",  no_argument,  NULL, 'X' },
+    { "iterations", required_argument,  NULL, 'i' },
+    { "accuracy",   no_argument,        NULL, 'a' },
+    { "budget",     required_argument,  NULL, 'b' },
+    { "root",       no_argument,        NULL, 'r' },
+    { "stages",     no_argument,        NULL, 's' },
+    { "json",       no_argument,        NULL, 'j' },
+    { "synthetic",  no_argument,        NULL, 'G' },
+    { "golden",     optional_argument,  NULL, 'g' },
+    { "golden-write", required_argument, NULL, 'w' },
+    { "recording",  no_argument,        NULL, 'e' },
+    { 0, 0, 0, 0 }
+};
+
+static void usage(FILE *fp, int, char**argv)
+{
+    fprintf(fp,
+            "Usage: %s [options]\n\n"
+            "Options:\n"
+            "-h | --help                Print this message\n"
+            "-d | --device PATH         [REQUIRED] Raw recording (--save-raw output)\n"
+            "-n | --nvram PATH          [REQUIRED] NVRAM file path\n"
+            "-C | --ignore-EE-check     Skip NVRAM validity check\n"
+            "-X | --extended-format     Treat the file as 27 lines per frame\n"
+            "-i | --iterations N        Passes over the recording [default: 200]\n"
+            "-a | --accuracy            Report max and RMS deviation of every kernel\n"
+            "               from the double precision reference instead of timing\n"
+            "-b | --budget DEGREES      Acceptable max deviation for -a and -g [default: 0.05]\n"
+            "-r | --root                Max error and throughput of each fourth root\n"
+            "               method over -40..300 degC; needs no -d/-n\n"
+            "-s | --stages              ns/frame of init_ee, read_raw, process_frame,\n"
+            "               process_pixel and the GRAY16 mapping, warm and cold caches\n"
+            "               Fails if --compress-raw does not decode back to the frames.\n"
+            "-j | --json                Print the -s results as JSON only\n"
+            "-G | --synthetic           Generate the NVRAM and the recordings instead of\n"
+            "               -d/-n; -s then runs on both the 26- and 27-line formats\n"
+            "-g | --golden[=FILE]       Check To[], the notable pixels and GRAY16 of every\n"
+            "               path against the golden vectors in FILE, or against the\n"
+            "               reference path if none; fails if any is out of budget\n"
+            "-w | --golden-write FILE   Record the reference path's golden vectors to FILE\n"
+            "-e | --recording           Write a --record container of synthetic frames with\n"
+            "               uneven timestamps and check what reads back; needs no -d/-n\n"
+            "",
+            argv[0]);
+}
+
+typedef std::vector<uint16_t> frame_t;
+
+enum pixel_path {
+    PATH_REFERENCE,
+    PATH_KERNEL,
+    PATH_FIXED,
+    PATH_GRAY16,
+    PATH_FIXED_GRAY16
+};
+
+static void run_path(mlx90640_frame & mlx, pixel_path path) {
+    static uint16_t gray16[0x300];
+
+    switch (path) {
+    case PATH_REFERENCE:
+        mlx.process_pixel_reference();
+        break;
+    case PATH_KERNEL:
+        mlx.process_pixel();
+        break;
+    case PATH_FIXED:
+        mlx.process_pixel_fixed();
+        break;
+    case PATH_GRAY16:
+        mlx.process_pixel_gray16(gray16);
+        break;
+    case PATH_FIXED_GRAY16:
+        mlx.process_pixel_fixed_gray16(gray16);
+        break;
+    }
+}
+
+// CPU cycles of this thread, if the kernel lets us count them.
+static int cycle_counter = -2;
+
+static void open_cycle_counter(void) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    cycle_counter = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static long long read_cycles(void) {
+    long long c;
+    if (cycle_counter < 0 || read(cycle_counter, &c, sizeof(c)) != sizeof(c))
+        return -1;
+    return c;
+}
+
+struct frame_cost {
+    double ns;
+    double cycles;  // < 0 if not available
+};
+
+static frame_cost time_per_frame(mlx90640 & mlx, const std::vector<frame_t> & frames,
+                                 int iterations, pixel_path path) {
+    if (cycle_counter == -2)
+        open_cycle_counter();
+
+    long long c_begin = read_cycles();
+    auto begin = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; it++) {
+        for (const frame_t & f : frames) {
+            mlx.load_frame(f.data());
+            mlx.process_frame();
+            run_path(mlx, path);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    long long c_end = read_cycles();
+
+    double n = (double)iterations * frames.size();
+    return {
+        std::chrono::duration<double, std::nano>(end - begin).count() / n,
+        (c_begin < 0 || c_end < 0) ? -1.0 : (double)(c_end - c_begin) / n
+    };
+}
+
+static void print_cost(const char * name, frame_cost c) {
+    if (c.cycles < 0)
+        printf("%-24s %12.1f %14s\n", name, c.ns, "-");
+    else
+        printf("%-24s %12.1f %14.0f\n", name, c.ns, c.cycles);
+}
+
+struct deviation {
+    double max;
+    double rms;
+};
+
+static deviation compare_to_reference(mlx90640 & ref, mlx90640 & mlx,
+                                      const std::vector<frame_t> & frames, bool extended,
+                                      pixel_path path) {
+    double max = 0;
+    double sum_sq = 0;
+    long n = 0;
+
+    for (size_t i = 0; i < frames.size(); i++) {
+        ref.load_frame(frames[i].data());
+        ref.process_frame();
+        ref.process_pixel_reference();
+
+        mlx.load_frame(frames[i].data());
+        mlx.process_frame();
+        run_path(mlx, path);
+
+        // The other subpage of the first extended frame was never computed.
+        if (extended && i == 0)
+            continue;
+
+        for (int p = 0; p < 0x300; p++) {
+            double To = path == PATH_FIXED
+                ? mlx.To_cK_()[p] / 100.0 - 273.15
+                : mlx.To_()[p];
+            double d = std::fabs(To - ref.To_()[p]);
+            if (d > max)
+                max = d;
+            sum_sq += d * d;
+            n++;
+        }
+    }
+
+    return { max, n ? std::sqrt(sum_sq / n) : 0.0 };
+}
+
+// x = T^4 for T over the sensor range, -40..300 degC
+static std::vector<double> root_inputs(void) {
+    std::vector<double> x;
+    for (double T = 233.15; T <= 573.15; T += 0.001)
+        x.push_back((T * T) * (T * T));
+    return x;
+}
+
+template<typename F, root_method R>
+static void bench_root(const std::vector<double> & x, int iterations) {
+    std::vector<F> in(x.begin(), x.end());
+    double max_err = 0;
+
+    for (size_t i = 0; i < x.size(); i++) {
+        long double ref = powl((long double)in[i], 0.25L);
+        double err = std::fabs((double)((long double)fourth_root<R>(in[i]) - ref));
+        if (err > max_err)
+            max_err = err;
+    }
+
+    volatile F sink = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; it++) {
+        F acc = 0;
+        for (F v : in)
+            acc += fourth_root<R>(v);
+        sink = sink + acc;
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - begin).count()
+        / ((double)iterations * in.size());
+
+    printf("%-8s %-8s %12.2e %12.2f\n", root_method_name(R),
+        sizeof(F) == sizeof(float) ? "float" : "double", max_err, ns);
+}
+
+static std::vector<frame_t> load_recording(const char * path, bool extended) {
+    std::vector<frame_t> frames;
+    dev_handler device(dev_handler::IO_METHOD_READ, -1, extended);
+    device.init_frame_file(path);
+    frame_t f(0x360);
+    while (device.read_frame_file(f.data()))
+        frames.push_back(f);
+    return frames;
+}
+
+// Stage timings (-s)
+
+// Passes with cold caches are slow, this many calls per stage is enough
+#define COLD_CALLS 32
+// Larger than the last level cache of anything we run on
+#define EVICT_BYTES (64 << 20)
+
+static void evict_caches(void) {
+    static std::vector<uint8_t> junk(EVICT_BYTES);
+    static uint8_t pass = 0;
+
+    pass++;
+    for (size_t i = 0; i < junk.size(); i += 64)
+        junk[i] = pass;
+}
+
+// What a back-to-back pair of steady_clock::now() costs, taken off every call
+static double timer_overhead_ns(void) {
+    const int n = 100000;
+    double total = 0;
+    for (int i = 0; i < n; i++) {
+        auto t0 = std::chrono::steady_clock::now();
+        auto t1 = std::chrono::steady_clock::now();
+        total += std::chrono::duration<double, std::nano>(t1 - t0).count();
+    }
+    return total / n;
+}
+
+struct stage_result {
+    int lines;
+    const char * stage;
+    bool cold;
+    unsigned long calls;
+    double ns;
+};
+
+// prep(i) readies call i untimed, only step(i) is timed. Warm runs get an
+// untimed pass of `warm_up` calls first, cold runs evict before every call.
+template<typename P, typename S>
+static double time_stage(unsigned long calls, unsigned long warm_up, bool cold,
+                         double overhead, P prep, S step) {
+    if (!cold) {
+        for (unsigned long i = 0; i < warm_up; i++) {
+            prep(i);
+            step(i);
+        }
+    }
+
+    double total = 0;
+    for (unsigned long i = 0; i < calls; i++) {
+        prep(i);
+        if (cold)
+            evict_caches();
+        auto t0 = std::chrono::steady_clock::now();
+        step(i);
+        auto t1 = std::chrono::steady_clock::now();
+        total += std::chrono::duration<double, std::nano>(t1 - t0).count() - overhead;
+    }
+    return total / calls;
+}
+
+// The frames through raw_encoder and back, untimed: false, with the first
+// mismatch printed, unless every one comes back word for word
+static bool check_raw_codec(const std::vector<frame_t> & frames, bool extended) {
+    size_t words = extended ? 0x360 : 0x340;
+    raw_encoder encoder(words);
+    std::vector<uint8_t> packed(sizeof(rawz_header) + frames.size() * encoder.max_record_bytes());
+    size_t packed_bytes = sizeof(rawz_header);
+    encoder.header(packed.data());
+    for (const frame_t & f : frames)
+        packed_bytes += encoder.encode(f.data(), &packed[packed_bytes]);
+
+    raw_decoder decoder;
+    frame_t buf(0x360);
+    if (!decoder.open(packed.data(), packed_bytes)) {
+        printf("raw_codec: cannot reopen what was encoded\n");
+        return false;
+    }
+    for (size_t i = 0; i < frames.size(); i++) {
+        if (!decoder.decode(buf.data())) {
+            printf("raw_codec: frame %zu of %zu does not decode\n", i, frames.size());
+            return false;
+        }
+        if (memcmp(buf.data(), frames[i].data(), words * sizeof(uint16_t)) != 0) {
+            printf("raw_codec: frame %zu does not decode to what was encoded\n", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void run_stages(const char * nv_name, const char * dev_name, bool extended,
+                       bool ignore_ee_check, int iterations, double overhead,
+                       std::vector<stage_result> & results) {
+    std::vector<frame_t> frames = load_recording(dev_name, extended);
+    if (frames.empty()) {
+        printf("No frames in %s\n", dev_name);
+        exit(EXIT_FAILURE);
+    }
+    unsigned long nframes = frames.size();
+    int lines = extended ? 27 : 26;
+
+    // encode_raw and decode_raw are only worth timing if they are lossless
+    if (!check_raw_codec(frames, extended))
+        exit(EXIT_FAILURE);
+
+    mlx90640_calibration calib;
+    // init_ee() reports every read on std::cout
+    std::streambuf * out = std::cout.rdbuf(nullptr);
+    bool ok = calib.init_ee(nv_name, ignore_ee_check);
+    std::cout.rdbuf(out);
+    std::cout.clear();
+    if (!ok) {
+        printf("NVMEM initialization error\n");
+        exit(EXIT_FAILURE);
+    }
+
+    mlx90640_frame ctx(calib);
+    ctx.set_extended(extended);
+    uint16_t gray16[0x300];
+    frame_t buf(0x360);
+    dev_handler * source = nullptr;
+
+    auto none = [](unsigned long) {};
+    auto frame_ready = [&](unsigned long i) {
+        ctx.view_frame(frames[i % nframes].data());
+        ctx.process_frame();
+    };
+    auto pixel_ready = [&](unsigned long i) {
+        frame_ready(i);
+        ctx.process_pixel();
+    };
+    auto pixel_fixed_ready = [&](unsigned long i) {
+        frame_ready(i);
+        ctx.process_pixel_fixed();
+    };
+    // One pass over the file per dev_handler, reopened untimed at its end
+    unsigned long file_frames = 0;
+    auto rewind_source = [&](unsigned long i) {
+        if (source != nullptr && i % file_frames != 0)
+            return;
+        delete source;
+        source = new dev_handler(dev_handler::IO_METHOD_READ, -1, extended);
+        source->init_frame_file(dev_name);
+        file_frames = source->frame_count();
+    };
+    rewind_source(0);
+    unsigned long raw_calls = file_frames; // 0 for pipes, which can't be rewound
+
+    for (int cold = 0; cold < 2; cold++) {
+        unsigned long calls = cold ? std::min<unsigned long>(COLD_CALLS, nframes)
+                                   : nframes * iterations;
+        unsigned long ee_calls = cold ? COLD_CALLS : iterations;
+        double ns;
+
+        std::cout.rdbuf(nullptr);
+        ns = time_stage(ee_calls, 1, cold, overhead, none,
+            [&](unsigned long) { calib.init_ee(nv_name, ignore_ee_check); });
+        std::cout.rdbuf(out);
+        std::cout.clear();
+        results.push_back({ lines, "init_ee", (bool)cold, ee_calls, ns });
+
+        if (raw_calls) {
+            unsigned long n = cold ? std::min<unsigned long>(COLD_CALLS, raw_calls) : raw_calls;
+            delete source;
+            source = nullptr;
+            file_frames = raw_calls;
+            ns = time_stage(n, raw_calls, cold, overhead, rewind_source,
+                [&](unsigned long) { source->read_frame_file(buf.data()); });
+            results.push_back({ lines, "read_raw", (bool)cold, n, ns });
+        }
+
+        ns = time_stage(calls, nframes, cold, overhead, none, frame_ready);
+        results.push_back({ lines, "process_frame", (bool)cold, calls, ns });
+
+        ns = time_stage(calls, nframes, cold, overhead, frame_ready,
+            [&](unsigned long) { ctx.process_pixel(); });
+        results.push_back({ lines, "process_pixel", (bool)cold, calls, ns });
+
+        ns = time_stage(calls, nframes, cold, overhead, pixel_ready,
+            [&](unsigned long) { ctx.map_gray16(gray16); });
+        results.push_back({ lines, "map_gray16", (bool)cold, calls, ns });
+
+        ns = time_stage(calls, nframes, cold, overhead, frame_ready,
+            [&](unsigned long) { ctx.process_pixel_fixed(); });
+        results.push_back({ lines, "process_pixel_fixed", (bool)cold, calls, ns });
+
+        ns = time_stage(calls, nframes, cold, overhead, pixel_fixed_ready,
+            [&](unsigned long) { ctx.map_gray16_fixed(gray16); });
+        results.push_back({ lines, "map_gray16_fixed", (bool)cold, calls, ns });
+
+        // --compress-raw, on the recorder thread
+        raw_encoder encoder(extended ? 0x360 : 0x340);
+        std::vector<uint8_t> packed(sizeof(rawz_header) + nframes * encoder.max_record_bytes());
+        ns = time_stage(calls, nframes, cold, overhead, none,
+            [&](unsigned long i) { encoder.encode(frames[i % nframes].data(), packed.data()); });
+        results.push_back({ lines, "encode_raw", (bool)cold, calls, ns });
+
+        // Replay of the same frames compressed, reopened untimed at the end
+        raw_encoder stream_encoder(extended ? 0x360 : 0x340);
+        size_t packed_bytes = sizeof(rawz_header);
+        stream_encoder.header(packed.data());
+        for (unsigned long i = 0; i < nframes; i++)
+            packed_bytes += stream_encoder.encode(frames[i].data(), &packed[packed_bytes]);
+        raw_decoder decoder;
+        ns = time_stage(calls, nframes, cold, overhead,
+            [&](unsigned long i) {
+                if (i % nframes == 0)
+                    decoder.open(packed.data(), packed_bytes);
+            },
+            [&](unsigned long) { decoder.decode(buf.data()); });
+        results.push_back({ lines, "decode_raw", (bool)cold, calls, ns });
+
+        // All of the above but init_ee and read_raw, as main.cpp runs it
+        ns = time_stage(calls, nframes, cold, overhead, none,
+            [&](unsigned long i) {
+                ctx.view_frame(frames[i % nframes].data());
+                ctx.process_frame();
+                ctx.process_pixel_gray16(gray16);
+            });
+        results.push_back({ lines, "frame_to_gray16", (bool)cold, calls, ns });
+    }
+    delete source;
+}
+
+static void print_stages(const std::vector<stage_result> & results, const char * kernel,
+                         int iterations, double overhead, bool json) {
+    if (!json) {
+        printf("kernel %s, %d iterations, timer overhead %.1f ns\n", kernel, iterations, overhead);
+        printf("%-5s %-20s %-5s %8s %12s %12s\n",
+            "lines", "stage", "cache", "calls", "ns/frame", "frames/s");
+        for (const stage_result & r : results)
+            printf("%-5d %-20s %-5s %8lu %12.1f %12.0f\n", r.lines, r.stage,
+                r.cold ? "cold" : "warm", r.calls, r.ns, r.ns > 0 ? 1e9 / r.ns : 0.0);
+        return;
+    }
+
+    printf("{\n");
+    printf("  \"compiler\": \"%s\",\n", __VERSION__);
+    printf("  \"kernel\": \"%s\",\n", kernel);
+    printf("  \"iterations\": %d,\n", iterations);
+    printf("  \"timer_overhead_ns\": %.1f,\n", overhead);
+    printf("  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const stage_result & r = results[i];
+        printf("    { \"lines\": %d, \"stage\": \"%s\", \"cache\": \"%s\", \"calls\": %lu,"
+               " \"ns_per_frame\": %.1f, \"frames_per_s\": %.0f }%s\n",
+            r.lines, r.stage, r.cold ? "cold" : "warm", r.calls,
+            r.ns, r.ns > 0 ? 1e9 / r.ns : 0.0, i + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n");
+    printf("}\n");
+}
+
+// Synthetic fixtures (-G), removed again at exit
+
+// Enough frames that read_raw isn't timing a handful of cache lines
+#define SYNTHETIC_FRAMES 1024
+
+static std::string fixture_dir;
+static std::string fixture_ee;
+static std::string fixture_rec[2]; // 26 and 27 lines
+static std::string fixture_container;
+
+static void remove_fixtures(void) {
+    unlink(fixture_container.c_str());
+    unlink(fixture_ee.c_str());
+    unlink(fixture_rec[0].c_str());
+    unlink(fixture_rec[1].c_str());
+    rmdir(fixture_dir.c_str());
+}
+
+static void make_fixtures(void) {
+    const char * tmp = getenv("TMPDIR");
+    std::string pattern = std::string(tmp ? tmp : "/tmp") + "/mlx90640_bench.XXXXXX";
+    std::vector<char> dir(pattern.begin(), pattern.end());
+    dir.push_back('\0');
+    if (mkdtemp(dir.data()) == NULL) {
+        perror("mkdtemp");
+        exit(EXIT_FAILURE);
+    }
+
+    fixture_dir = dir.data();
+    fixture_ee = fixture_dir + "/ee.bin";
+    fixture_rec[0] = fixture_dir + "/26.raw";
+    fixture_rec[1] = fixture_dir + "/27.raw";
+    fixture_container = fixture_dir + "/rec.mlxr";
+    atexit(remove_fixtures);
+
+    synthetic_sensor sensor;
+    if (!sensor.write_ee(fixture_ee.c_str())
+            || !sensor.write_recording(fixture_rec[0].c_str(), SYNTHETIC_FRAMES, false)
+            || !sensor.write_recording(fixture_rec[1].c_str(), SYNTHETIC_FRAMES, true)) {
+        fprintf(stderr, "Cannot write the synthetic fixtures to %s: %d, %s\n",
+                fixture_dir.c_str(), errno, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Recording container round trip (-e)
+
+#define RECORDING_FRAMES 600
+#define RECORDING_PERIOD 15625000   // 64 fps
+
+// Steady, then jittery, two stalls, then runs of repeated times (a coarse
+// clock), so seek_time() has to correct its guess both ways
+static std::vector<int64_t> recording_timestamps(unsigned long n) {
+    std::vector<int64_t> ts(n);
+    int64_t t = 1700000000000000000LL;
+    uint32_t state = 1;
+
+    for (unsigned long i = 0; i < n; i++) {
+        state = state * 1664525 + 1013904223;
+        int64_t period = RECORDING_PERIOD;
+        if (i >= n / 4 && i < n / 2)
+            period += (int64_t)(state % 4000000) - 2000000;
+        else if (i == n / 2 || i == 2 * n / 3)
+            period *= 300;
+        else if (i > 3 * n / 4 && state % 3 == 0)
+            period = 0;
+        t += period;
+        ts[i] = t;
+    }
+    return ts;
+}
+
+// false with the first mismatch printed
+static bool check_recording(const synthetic_sensor & sensor, bool extended, const char * path) {
+    unsigned long n = RECORDING_FRAMES;
+    size_t words = extended ? 0x360 : 0x340;
+    size_t bytes = words * sizeof(uint16_t);
+    int lines = extended ? 27 : 26;
+    auto fail = [&](const char * what, unsigned long i) {
+        printf("recording, %d lines: %s (frame %lu)\n", lines, what, i);
+        return false;
+    };
+
+    std::vector<frame_t> frames(n, frame_t(0x360));
+    for (unsigned long i = 0; i < n; i++)
+        sensor.frame(i, extended, frames[i].data());
+    std::vector<int64_t> ts = recording_timestamps(n);
+
+    recorder rec;
+    recorder_config config = { nullptr, nullptr, path, words, false,
+                               sensor.ee_image().word_, 64, false };
+    if (!rec.start(config))
+        return fail("cannot start the recorder", 0);
+    for (unsigned long i = 0; i < n; i++)
+        rec.record(frames[i].data(), frames[i].data(), ts[i]);
+    recorder_stats rs = rec.stop();
+    if (rs.frames != n || rs.overflows || rs.errors)
+        return fail("recorder lost frames", rs.frames);
+
+    {
+        recording r;
+        if (!r.open(path))
+            return fail("cannot open", 0);
+        if (!r.indexed() || r.frames() != n || r.words() != words || r.fps() != 64)
+            return fail("header or index", r.frames());
+        if (memcmp(r.ee(), sensor.ee_image().word_, 0x340 * sizeof(uint16_t)) != 0)
+            return fail("EE does not round-trip", 0);
+
+        for (unsigned long i = 0; i < n; i++) {
+            if (r.timestamp(i) != ts[i])
+                return fail("timestamp", i);
+            if (memcmp(r.frame_ptr(i), frames[i].data(), bytes) != 0)
+                return fail("frame_ptr", i);
+        }
+
+        // Every timestamp, either side of it and halfway to the next,
+        // and past both ends
+        std::vector<int64_t> probes = { ts.front() - 1000000000, ts.back() + 1000000000 };
+        for (unsigned long i = 0; i < n; i++) {
+            probes.push_back(ts[i] - 1);
+            probes.push_back(ts[i]);
+            probes.push_back(ts[i] + 1);
+            if (i + 1 < n)
+                probes.push_back(ts[i] + (ts[i + 1] - ts[i]) / 2);
+        }
+        for (int64_t t : probes) {
+            unsigned long want = std::lower_bound(ts.begin(), ts.end(), t) - ts.begin();
+            if (r.seek_time(t) != want)
+                return fail("seek_time() differs from lower_bound", want);
+        }
+
+        // Whole, in odd-sized ranges, and out of range
+        std::vector<uint16_t> buf(n * words);
+        for (unsigned long count : { n, 7ul, 1ul }) {
+            for (unsigned long first = 0; first + count <= n; first += count) {
+                if (!r.read_frames(first, count, buf.data()))
+                    return fail("read_frames() failed", first);
+                for (unsigned long i = 0; i < count; i++)
+                    if (memcmp(&buf[i * words], frames[first + i].data(), bytes) != 0)
+                        return fail("read_frames() differs", first + i);
+            }
+        }
+        if (!r.read_frames(n, 0, buf.data()) || r.read_frames(n - 1, 2, buf.data()))
+            return fail("read_frames() past the end", n);
+    }
+
+    // Cut short mid-frame, as if recording was interrupted: no index, the
+    // whole frames still read back
+    unsigned long kept = n / 2;
+    if (truncate(path, REC_DATA_OFFSET + kept * bytes + bytes / 2) != 0)
+        return fail("cannot truncate", kept);
+    recording r;
+    if (!r.open(path) || r.indexed() || r.frames() != kept)
+        return fail("interrupted recording", r.frames());
+    std::vector<uint16_t> buf(kept * words);
+    if (!r.read_frames(0, kept, buf.data()))
+        return fail("read_frames() on the interrupted recording", 0);
+    for (unsigned long i = 0; i < kept; i++)
+        if (memcmp(&buf[i * words], frames[i].data(), bytes) != 0)
+            return fail("interrupted recording differs", i);
+
+    printf("recording, %d lines: %lu frames, %zu seeks ok\n", lines, n, 2 + 4 * n - 1);
+    return true;
+}
+
+// Golden vectors (-g/-w): the outputs of process_pixel_reference() for every
+// frame of a recording, so that an optimized path is checked against a file
+// made by a trusted build rather than against the same build's reference.
+// Little endian whatever the host, like the recordings they go with:
+//     magic[8], uint32 lines, uint32 frames
+//     per frame: To[0x300] as IEEE doubles, 3 x (int32 x, int32 y, double T)
+//                for the notable pixels, gray16[0x300]
+
+#define GOLDEN_MAGIC "MLXGOLD2"
+#define GOLDEN_HEADER_BYTES 16
+#define GOLDEN_FRAME_BYTES (0x300 * 8 + 3 * 16 + 0x300 * 2)
+
+struct golden_frame {
+    double To[0x300];
+    mlx90640_frame::notable_pxls_t notable;
+    uint16_t gray16[0x300];
+};
+
+static uint8_t * put_le32(uint8_t * p, uint32_t v) {
+    v = htole32(v);
+    memcpy(p, &v, 4);
+    return p + 4;
+}
+
+static uint8_t * put_le_double(uint8_t * p, double d) {
+    uint64_t v;
+    memcpy(&v, &d, 8);
+    v = htole64(v);
+    memcpy(p, &v, 8);
+    return p + 8;
+}
+
+static const uint8_t * get_le32(const uint8_t * p, uint32_t & v) {
+    memcpy(&v, p, 4);
+    v = le32toh(v);
+    return p + 4;
+}
+
+static const uint8_t * get_le_double(const uint8_t * p, double & d) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    v = le64toh(v);
+    memcpy(&d, &v, 8);
+    return p + 8;
+}
+
+static void pack_golden(const golden_frame & g, uint8_t * p) {
+    for (int i = 0; i < 0x300; i++)
+        p = put_le_double(p, g.To[i]);
+    for (int n = 0; n < 3; n++) {
+        p = put_le32(p, (uint32_t)g.notable[n].x);
+        p = put_le32(p, (uint32_t)g.notable[n].y);
+        p = put_le_double(p, g.notable[n].T);
+    }
+    for (int i = 0; i < 0x300; i++) {
+        uint16_t v = htole16(g.gray16[i]);
+        memcpy(p, &v, 2);
+        p += 2;
+    }
+}
+
+static void unpack_golden(const uint8_t * p, golden_frame & g) {
+    for (int i = 0; i < 0x300; i++)
+        p = get_le_double(p, g.To[i]);
+    for (int n = 0; n < 3; n++) {
+        uint32_t v;
+        p = get_le32(p, v);
+        g.notable[n].x = (int32_t)v;
+        p = get_le32(p, v);
+        g.notable[n].y = (int32_t)v;
+        p = get_le_double(p, g.notable[n].T);
+    }
+    for (int i = 0; i < 0x300; i++) {
+        uint16_t v;
+        memcpy(&v, p, 2);
+        g.gray16[i] = le16toh(v);
+        p += 2;
+    }
+}
+
+static std::vector<golden_frame> record_golden(const mlx90640_calibration & calib,
+                                               const std::vector<frame_t> & frames,
+                                               bool extended) {
+    std::vector<golden_frame> golden(frames.size());
+    mlx90640_frame ctx(calib);
+    ctx.set_extended(extended);
+
+    for (size_t i = 0; i < frames.size(); i++) {
+        ctx.load_frame(frames[i].data());
+        ctx.process_frame();
+        ctx.process_pixel_reference();
+        memcpy(golden[i].To, ctx.To_(), sizeof(golden[i].To));
+        memcpy(golden[i].notable, *ctx.pix_notable(), sizeof(golden[i].notable));
+        ctx.map_gray16(golden[i].gray16);
+    }
+    return golden;
+}
+
+static bool write_golden(const char * path, bool extended,
+                         const std::vector<golden_frame> & golden) {
+    uint8_t h[GOLDEN_HEADER_BYTES];
+    memcpy(h, GOLDEN_MAGIC, 8);
+    put_le32(put_le32(h + 8, extended ? 27 : 26), golden.size());
+
+    FILE * f = fopen(path, "wb");
+    if (f == NULL)
+        return false;
+    bool ok = fwrite(h, sizeof(h), 1, f) == 1;
+    std::vector<uint8_t> packed(GOLDEN_FRAME_BYTES);
+    for (size_t i = 0; ok && i < golden.size(); i++) {
+        pack_golden(golden[i], packed.data());
+        ok = fwrite(packed.data(), packed.size(), 1, f) == 1;
+    }
+    if (fclose(f) != 0)
+        ok = false;
+    return ok;
+}
+
+static bool read_golden(const char * path, bool extended, size_t frames,
+                        std::vector<golden_frame> & golden) {
+    uint8_t h[GOLDEN_HEADER_BYTES];
+    uint32_t lines, count;
+    FILE * f = fopen(path, "rb");
+    if (f == NULL) {
+        printf("Cannot open '%s': %d, %s\n", path, errno, strerror(errno));
+        return false;
+    }
+    if (fread(h, sizeof(h), 1, f) != 1 || memcmp(h, GOLDEN_MAGIC, 8)) {
+        printf("%s is not a golden vector file\n", path);
+        fclose(f);
+        return false;
+    }
+    get_le32(get_le32(h + 8, lines), count);
+    if (lines != (extended ? 27u : 26u) || count != frames) {
+        printf("%s was made from %u frames of %u lines, the recording has %zu of %d\n",
+            path, count, lines, frames, extended ? 27 : 26);
+        fclose(f);
+        return false;
+    }
+
+    golden.resize(count);
+    std::vector<uint8_t> packed(GOLDEN_FRAME_BYTES);
+    bool ok = true;
+    for (size_t i = 0; ok && i < golden.size(); i++) {
+        ok = fread(packed.data(), packed.size(), 1, f) == 1;
+        if (ok)
+            unpack_golden(packed.data(), golden[i]);
+    }
+    fclose(f);
+    if (!ok)
+        printf("%s is truncated\n", path);
+    return ok;
+}
+
+struct golden_result {
+    double To_max;              // K
+    unsigned long To_fails;     // pixels off by more than the budget
+    unsigned long notable_fails;
+    int gray16_max;             // LSB
+    unsigned long gray16_fails;
+
+    bool pass() const { return To_fails == 0 && notable_fails == 0 && gray16_fails == 0; }
+};
+
+// ctx must be fresh, like the one record_golden() used.
+// Every pixel of To[] has to be within budget. The notable pixels have to be
+// within budget too, and may only move to a pixel that ties with the golden
+// one within budget. GRAY16 may move by what budget is worth on the frame's
+// min-max scale, plus one for the rounding down.
+static golden_result check_golden(mlx90640_frame & ctx, const std::vector<frame_t> & frames,
+                                  bool extended, const std::vector<golden_frame> & golden,
+                                  pixel_path path, double budget) {
+    golden_result r = { 0, 0, 0, 0, 0 };
+    uint16_t gray16[0x300];
+    ctx.set_extended(extended);
+
+    for (size_t i = 0; i < frames.size(); i++) {
+        const golden_frame & g = golden[i];
+
+        ctx.load_frame(frames[i].data());
+        ctx.process_frame();
+        run_path(ctx, path);
+        if (path == PATH_FIXED)
+            ctx.map_gray16_fixed(gray16);
+        else
+            ctx.map_gray16(gray16);
+
+        // The other subpage of the first extended frame was never computed.
+        if (extended && i == 0)
+            continue;
+
+        for (int p = 0; p < 0x300; p++) {
+            double To = path == PATH_FIXED
+                ? ctx.To_cK_()[p] / 100.0 - 273.15
+                : ctx.To_()[p];
+            double d = std::fabs(To - g.To[p]);
+            r.To_max = std::max(r.To_max, d);
+            r.To_fails += d > budget;
+        }
+
+        const mlx90640_frame::pixel * notable = *ctx.pix_notable();
+        for (int n = 0; n < 3; n++) {
+            double golden_T_there = g.To[notable[n].y * 32 + notable[n].x];
+            r.notable_fails += std::fabs(notable[n].T - g.notable[n].T) > budget
+                || std::fabs(golden_T_there - g.notable[n].T) > budget;
+        }
+
+        double range = g.notable[mlx90640_frame::MAX_T].T - g.notable[mlx90640_frame::MIN_T].T;
+        int lsb_budget = (int)std::ceil(2 * budget * 65535 / range) + 1;
+        for (int p = 0; p < 0x300; p++) {
+            int d = std::abs((int)gray16[p] - (int)g.gray16[p]);
+            r.gray16_max = std::max(r.gray16_max, d);
+            r.gray16_fails += d > lsb_budget;
+        }
+    }
+    return r;
+}
+
+static void print_golden(const char * name, const golden_result & r) {
+    printf("%-24s %10.3e %8lu %8lu %8d %8lu %s\n", name, r.To_max, r.To_fails,
+        r.notable_fails, r.gray16_max, r.gray16_fails, r.pass() ? "ok" : "FAIL");
+}
+
+// -g: every path against the golden vectors, from golden_path or, if NULL,
+// recorded in place. false if any path is out of budget.
+static bool run_golden(const mlx90640_calibration & calib, const char * dev_name,
+                       bool extended, const char * golden_path, double budget) {
+    std::vector<frame_t> frames = load_recording(dev_name, extended);
+    std::vector<golden_frame> golden;
+    if (golden_path == NULL)
+        golden = record_golden(calib, frames, extended);
+    else if (!read_golden(golden_path, extended, frames.size(), golden))
+        exit(EXIT_FAILURE);
+
+    const char * names[] = { "scalar", "sse4", "avx2", "neon" };
+    const root_method roots[] = { ROOT_POW, ROOT_SQRT, ROOT_NEWTON };
+    bool pass = true;
+
+    printf("%zu frames of %d lines against %s, budget %.3f K\n", frames.size(),
+        extended ? 27 : 26, golden_path ? golden_path : "the reference path", budget);
+    printf("%-24s %10s %8s %8s %8s %8s\n",
+        "path", "To max", "To >", "notable", "gray16", "gray16 >");
+    {
+        mlx90640_frame ctx(calib);
+        golden_result r = check_golden(ctx, frames, extended, golden, PATH_REFERENCE, budget);
+        print_golden("reference", r);
+        pass &= r.pass();
+    }
+    for (int single = 0; single < 2; single++) {
+        for (const char * name : names) {
+            for (root_method root : roots) {
+                mlx90640_frame ctx(calib);
+                if (!ctx.set_kernel(name, single))
+                    break;
+                ctx.set_root(root);
+                // The same as the sqrt row, not pow
+                if (ctx.root_used() != root)
+                    continue;
+
+                char label[32];
+                snprintf(label, sizeof(label), "%-6s %-6s %s", name,
+                    single ? "float" : "double", root_method_name(root));
+                golden_result r = check_golden(ctx, frames, extended, golden, PATH_KERNEL, budget);
+                print_golden(label, r);
+                pass &= r.pass();
+            }
+        }
+    }
+    {
+        mlx90640_frame ctx(calib);
+        golden_result r = check_golden(ctx, frames, extended, golden, PATH_FIXED, budget);
+        print_golden("fixed point", r);
+        pass &= r.pass();
+        // Integer-only per pixel means the double precision plan stays untouched
+        if (ctx.plan_folds_() != 0) {
+            printf("fixed point folded the floating point plan %lu times\n", ctx.plan_folds_());
+            pass = false;
+        }
+    }
+    return pass;
+}
+
+int main(int argc, char **argv) {
+    mlx90640 mlx = mlx90640();
+
+    char * dev_name = NULL;
+    char * nv_name = NULL;
+    bool ignore_ee_check = false;
+    bool extended_format = false;
+    int iterations = 200;
+    bool accuracy = false;
+    double budget = 0.05;
+    bool root = false;
+    bool stages = false;
+    bool json = false;
+    bool synthetic = false;
+    bool golden = false;
+    bool container = false;
+    const char * golden_path = NULL;
+    const char * golden_write = NULL;
+
+    for (;;) {
+        int idx;
+        int c;
+
+        c = getopt_long(argc, argv,
+                        short_options, long_options, &idx);
+
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'd':
+            dev_name = optarg;
+            break;
+
+        case 'n':
+            nv_name = optarg;
+            break;
+
+        case 'h':
+            usage(stdout, argc, argv);
+            exit(EXIT_SUCCESS);
+            break;
+
+        case 'C':
+            ignore_ee_check = true;
+            break;
+
+        case 'X':
+            extended_format = true;
+            break;
+
+        case 'i':
+            iterations = std::stoi(optarg);
+            break;
+
+        case 'a':
+            accuracy = true;
+            break;
+
+        case 'b':
+            budget = std::stod(optarg);
+            break;
+
+        case 'r':
+            root = true;
+            break;
+
+        case 's':
+            stages = true;
+            break;
+
+        case 'j':
+            json = true;
+            break;
+
+        case 'G':
+            synthetic = true;
+            break;
+
+        case 'g':
+            golden = true;
+            golden_path = optarg;
+            break;
+
+        case 'w':
+            golden_write = optarg;
+            break;
+
+        case 'e':
+            container = true;
+            break;
+
+        default:
+            usage(stdout, argc, argv);
+            exit(EXIT_FAILURE);
+            break;
+        }
+    }
+
+    // e.g. "-g FILE", which has to be --golden=FILE
+    if (optind < argc) {
+        printf("Unexpected argument: %s\n", argv[optind]);
+        usage(stdout, argc, argv);
+        exit(EXIT_FAILURE);
+    }
+
+    if (root) {
+        std::vector<double> x = root_inputs();
+        int n = iterations / 20 + 1;
+        printf("%zu inputs, %d iterations\n", x.size(), n);
+        printf("%-17s %12s %12s\n", "root", "max err (K)", "ns/root");
+        bench_root<double, ROOT_POW>(x, n);
+        bench_root<double, ROOT_SQRT>(x, n);
+        bench_root<double, ROOT_NEWTON>(x, n);
+        bench_root<float, ROOT_POW>(x, n);
+        bench_root<float, ROOT_SQRT>(x, n);
+        bench_root<float, ROOT_NEWTON>(x, n);
+        return 0;
+    }
+
+    if (container) {
+        make_fixtures();
+        synthetic_sensor sensor;
+        bool pass = check_recording(sensor, false, fixture_container.c_str())
+            & check_recording(sensor, true, fixture_container.c_str());
+        return pass ? 0 : 1;
+    }
+
+    if (synthetic) {
+        make_fixtures();
+        nv_name = (char *)fixture_ee.c_str();
+        dev_name = (char *)fixture_rec[1].c_str();
+        extended_format = true;
+        ignore_ee_check = false;
+    }
+
+    if (dev_name == NULL || nv_name == NULL) {
+        printf("Required option not given\n");
+        usage(stdout, argc, argv);
+        exit(EXIT_FAILURE);
+    }
+
+    // Nothing but the JSON on stdout, init_ee() reports on std::cout
+    if (json)
+        std::cout.rdbuf(nullptr);
+
+    if (!mlx.init_ee(nv_name, ignore_ee_check)) {
+        printf("NVMEM initialization error\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (golden_write) {
+        std::vector<frame_t> frames = load_recording(dev_name, extended_format);
+        if (!write_golden(golden_write, extended_format,
+                          record_golden(mlx.calibration(), frames, extended_format))) {
+            printf("Cannot write '%s': %d, %s\n", golden_write, errno, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        printf("%zu frames of golden vectors written to %s\n", frames.size(), golden_write);
+        return 0;
+    }
+
+    if (golden) {
+        bool pass;
+        if (synthetic && golden_path == NULL)
+            pass = run_golden(mlx.calibration(), fixture_rec[0].c_str(), false, NULL, budget)
+                & run_golden(mlx.calibration(), fixture_rec[1].c_str(), true, NULL, budget);
+        else
+            pass = run_golden(mlx.calibration(), dev_name, extended_format, golden_path, budget);
+        return pass ? 0 : 1;
+    }
+
+    if (stages) {
+        std::vector<stage_result> results;
+        double overhead = timer_overhead_ns();
+
+        if (synthetic) {
+            run_stages(nv_name, fixture_rec[0].c_str(), false, ignore_ee_check,
+                       iterations, overhead, results);
+            run_stages(nv_name, fixture_rec[1].c_str(), true, ignore_ee_check,
+                       iterations, overhead, results);
+        } else {
+            run_stages(nv_name, dev_name, extended_format, ignore_ee_check,
+                       iterations, overhead, results);
+        }
+        print_stages(results, mlx.kernel_name(), iterations, overhead, json);
+        return 0;
+    }
+
+    std::vector<frame_t> frames = load_recording(dev_name, extended_format);
+    if (frames.empty()) {
+        printf("No frames in %s\n", dev_name);
+        exit(EXIT_FAILURE);
+    }
+    mlx.set_extended(extended_format);
+
+    const char * names[] = { "scalar", "sse4", "avx2", "neon" };
+    const root_method roots[] = { ROOT_POW, ROOT_SQRT, ROOT_NEWTON };
+
+    if (accuracy) {
+        mlx90640 ref = mlx90640();
+        ref.init_ee(nv_name, ignore_ee_check);
+        ref.set_extended(extended_format);
+
+        printf("%zu frames, deviation from reference, budget %.3f\n", frames.size(), budget);
+        printf("%-24s %12s %12s\n", "kernel", "max", "rms");
+        for (int single = 0; single < 2; single++) {
+            for (const char * name : names) {
+                if (!mlx.set_kernel(name, single))
+                    continue;
+                for (root_method r : roots) {
+                    mlx.set_root(r);
+                    if (mlx.root_used() != r)
+                        continue;
+                    deviation d = compare_to_reference(ref, mlx, frames, extended_format, PATH_KERNEL);
+                    printf("%-6s %-6s %-10s %12.3e %12.3e %s\n", name, single ? "float" : "double",
+                        root_method_name(r), d.max, d.rms, d.max <= budget ? "" : "OVER BUDGET");
+                }
+            }
+        }
+        deviation d = compare_to_reference(ref, mlx, frames, extended_format, PATH_FIXED);
+        printf("%-24s %12.3e %12.3e %s\n", "fixed point (cK)",
+            d.max, d.rms, d.max <= budget ? "" : "OVER BUDGET");
+        return 0;
+    }
+
+    printf("%zu frames, %d iterations\n", frames.size(), iterations);
+    printf("%-24s %12s %14s\n", "path", "ns/frame", "cycles/frame");
+
+    // warm up tables and caches
+    time_per_frame(mlx, frames, 1, PATH_REFERENCE);
+    print_cost("reference (no plan)", time_per_frame(mlx, frames, iterations, PATH_REFERENCE));
+
+    for (int single = 0; single < 2; single++) {
+        for (const char * name : names) {
+            if (!mlx.set_kernel(name, single))
+                continue;
+            for (root_method r : roots) {
+                char label[32];
+                snprintf(label, sizeof(label), "%-6s %-6s %s", name,
+                    single ? "float" : "double", root_method_name(r));
+                mlx.set_root(r);
+                if (mlx.root_used() != r)
+                    continue;
+                time_per_frame(mlx, frames, 1, PATH_KERNEL);
+                print_cost(label, time_per_frame(mlx, frames, iterations, PATH_KERNEL));
+            }
+        }
+    }
+
+    time_per_frame(mlx, frames, 1, PATH_FIXED);
+    print_cost("fixed point", time_per_frame(mlx, frames, iterations, PATH_FIXED));
+
+    // with the GRAY16 output stage
+    mlx.set_kernel(nullptr);
+    mlx.set_root(ROOT_POW);
+    time_per_frame(mlx, frames, 1, PATH_GRAY16);
+    print_cost("auto + gray16", time_per_frame(mlx, frames, iterations, PATH_GRAY16));
+    time_per_frame(mlx, frames, 1, PATH_FIXED_GRAY16);
+    print_cost("fixed point + gray16", time_per_frame(mlx, frames, iterations, PATH_FIXED_GRAY16));
+
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include "dev_handler.hpp"
+#include "trace.hpp"
 
 void dev_handler::open_device(const char * path) {
     struct stat st;
@@ -21,6 +22,9 @@ void dev_handler::open_device(const char * path) {
     else{
         fd = open(path, O_RDONLY);
         open_ = true;
+        if (fd != -1 && S_ISREG(st.st_mode) && !map_packed(st.st_size)
+                && !map_container(path))
+            map_raw(st.st_size);
         return;
     }
 
@@ -60,6 +64,14 @@ void dev_handler::open_device(const char * path) {
     case IO_METHOD_MMAP:
             init_mmap();
             break;
+
+    case IO_METHOD_USERPTR:
+            init_userp(fmt.fmt.pix.sizeimage);
+            break;
+
+    case IO_METHOD_DMABUF:
+            init_dmabuf(fmt.fmt.pix.sizeimage);
+            break;
     }
     open_ = true;
 }
@@ -129,6 +141,8 @@ void dev_handler::init_v4l2_device(void) {
         break;
 
     case IO_METHOD_MMAP:
+    case IO_METHOD_USERPTR:
+    case IO_METHOD_DMABUF:
         if (!(cap.capabilities & V4L2_CAP_STREAMING)) {
             fprintf(stderr, "Device does not support streaming i/o\n");
             exit(EXIT_FAILURE);
@@ -139,19 +153,21 @@ void dev_handler::init_v4l2_device(void) {
 }
 
 
-void dev_handler::init_mmap(void) {
+void dev_handler::request_buffers(enum v4l2_memory memory) {
     struct v4l2_requestbuffers req;
 
     CLEAR(req);
 
-    req.count = BUF_COUNT;
+    req.count = buf_count;
     req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    req.memory = V4L2_MEMORY_MMAP;
+    req.memory = memory;
 
     if (-1 == xioctl(fd, VIDIOC_REQBUFS, &req)) {
         if (EINVAL == errno) {
-                fprintf(stderr, "Device does not support "
-                         "memory mapping\n");
+                fprintf(stderr, "Device does not support %s i/o\n",
+                         memory == V4L2_MEMORY_MMAP ? "memory mapping" :
+                         memory == V4L2_MEMORY_USERPTR ? "user pointer" :
+                         "dma-buf");
                 exit(EXIT_FAILURE);
         } else {
                 errno_exit("VIDIOC_REQBUFS");
@@ -162,15 +178,26 @@ void dev_handler::init_mmap(void) {
         fprintf(stderr, "Insufficient buffer memory on device\n");
         exit(EXIT_FAILURE);
     }
+    if (req.count != buf_count)
+        fprintf(stderr, "Warning: driver gave %u buffers instead of %u\n",
+                req.count, buf_count);
+    buf_count = req.count;
 
-    buffers = (buffer*) calloc(req.count, sizeof(*buffers));
+    buffers = (buffer*) calloc(buf_count, sizeof(*buffers));
 
     if (!buffers) {
         fprintf(stderr, "Out of memory\n");
         exit(EXIT_FAILURE);
     }
 
-    for (unsigned int n_buffers = 0; n_buffers < req.count; ++n_buffers) {
+    for (unsigned int i = 0; i < buf_count; ++i)
+        buffers[i].dmabuf_fd = -1;
+}
+
+void dev_handler::init_mmap(void) {
+    request_buffers(V4L2_MEMORY_MMAP);
+
+    for (unsigned int n_buffers = 0; n_buffers < buf_count; ++n_buffers) {
         struct v4l2_buffer buf;
 
         CLEAR(buf);
@@ -195,6 +222,68 @@ void dev_handler::init_mmap(void) {
     }
 }
 
+void dev_handler::init_userp(unsigned int buffer_size) {
+    // Page aligned: satisfies the cache line and any DMA constraints,
+    // and vb2 pins whole pages anyway.
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t length = (buffer_size + page - 1) & ~(page - 1);
+
+    request_buffers(V4L2_MEMORY_USERPTR);
+
+    for (unsigned int n_buffers = 0; n_buffers < buf_count; ++n_buffers) {
+        buffers[n_buffers].length = length;
+        if (0 != posix_memalign(&buffers[n_buffers].start, page, length)) {
+            fprintf(stderr, "Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+void dev_handler::init_dmabuf(unsigned int buffer_size) {
+    int heap = open(DMA_HEAP_PATH, O_RDONLY | O_CLOEXEC);
+    if (-1 == heap) {
+        fprintf(stderr, "Cannot open '%s': %d, %s\n",
+                DMA_HEAP_PATH, errno, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    request_buffers(V4L2_MEMORY_DMABUF);
+
+    for (unsigned int n_buffers = 0; n_buffers < buf_count; ++n_buffers) {
+        struct dma_heap_allocation_data alloc;
+
+        CLEAR(alloc);
+        alloc.len = buffer_size;
+        alloc.fd_flags = O_RDWR | O_CLOEXEC;
+
+        if (-1 == xioctl(heap, DMA_HEAP_IOCTL_ALLOC, &alloc))
+            errno_exit("DMA_HEAP_IOCTL_ALLOC");
+
+        buffers[n_buffers].dmabuf_fd = alloc.fd;
+        buffers[n_buffers].length = buffer_size;
+        buffers[n_buffers].start =
+                mmap(NULL, buffer_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, alloc.fd, 0);
+
+        if (MAP_FAILED == buffers[n_buffers].start)
+                    errno_exit("mmap");
+    }
+
+    close(heap);
+}
+
+// CPU access brackets for dma-bufs, so caches are kept coherent
+// with the device. Nothing to do for the other methods.
+void dev_handler::sync_buffer(unsigned int index, bool start) {
+    struct dma_buf_sync sync;
+
+    if (io_method != IO_METHOD_DMABUF)
+        return;
+
+    sync.flags = DMA_BUF_SYNC_READ | (start ? DMA_BUF_SYNC_START : DMA_BUF_SYNC_END);
+    if (-1 == xioctl(buffers[index].dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync))
+        errno_exit("DMA_BUF_IOCTL_SYNC");
+}
 
 void dev_handler::init_read(unsigned int buffer_size) {
     buffers = (buffer*)calloc(1, sizeof(*buffers));
@@ -213,11 +302,77 @@ void dev_handler::init_read(unsigned int buffer_size) {
     }
 }
 
-bool dev_handler::read_raw(void * dest) {
-    int size = extended ? 0x6c0 : 0x680;
-    int rdsz_ = read(fd, (unsigned char *)(dest),
-        //sizeof(dest) / sizeof(char)
-        size);
+// Recordings are mapped whole: frames are then read without a syscall,
+// or not copied at all through acquire_frame() and frame_ptr().
+// Pipes and such fall back to read().
+void dev_handler::map_raw(off_t size) {
+    size_t frame_size = extended ? 0x6c0 : 0x680;
+
+    raw_frames = size / frame_size;
+    if (raw_frames == 0)
+        return;
+
+    raw_map_length = size;
+    void * p = mmap(NULL, raw_map_length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "Warning: cannot map the raw file, reading it instead\n");
+        raw_frames = 0;
+        return;
+    }
+    madvise(p, raw_map_length, MADV_SEQUENTIAL);
+    raw_map = (const unsigned char *)p;
+}
+
+// A compressed recording is recognized by its header, whatever its name,
+// and replayed like a raw file. It knows its own line count, -X or not.
+// false: not one, go on with map_raw().
+bool dev_handler::map_packed(off_t size) {
+    rawz_header h;
+
+    if ((size_t)size < sizeof(h) || pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) ||
+            !raw_decoder::probe(&h, sizeof(h)))
+        return false;
+
+    void * p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+        errno_exit("mmap");
+    madvise(p, size, MADV_SEQUENTIAL);
+    packed_map = (const unsigned char *)p;
+    packed_length = size;
+
+    decoder = new raw_decoder();
+    if (!decoder->open(packed_map, packed_length))
+        exit(EXIT_FAILURE);
+    extended = decoder->words() == 0x360;
+    return true;
+}
+
+// Same for a recording container (recording.hpp), which also knows its
+// line count. Its frames are contiguous, so they are replayed through
+// raw_map like a raw file's.
+bool dev_handler::map_container(const char * path) {
+    if (!recording_probe(path))
+        return false;
+
+    container = new recording();
+    if (!container->open(path))
+        exit(EXIT_FAILURE);
+    extended = container->extended();
+    raw_frames = container->frames();
+    raw_map = (const unsigned char *)container->frame_ptr(0);
+    return true;
+}
+
+bool dev_handler::seek_start(double seconds) {
+    if (container == NULL)
+        return false;
+
+    raw_next = container->seek_time(container->start_time() + (int64_t)(seconds * 1e9));
+    return true;
+}
+
+void dev_handler::pace_replay(void) {
+    TRACE_SCOPE("pace_replay");
 
     switch (fps) {
         case -1:
@@ -233,6 +388,55 @@ bool dev_handler::read_raw(void * dest) {
                 exit(EXIT_FAILURE);
             }
     }
+}
+
+bool dev_handler::read_raw(void * dest, bool pace) {
+    int size = extended ? 0x6c0 : 0x680;
+
+    if (decoder != NULL) {
+        bool ok;
+        {
+            TRACE_SCOPE("decode_raw");
+            ok = decoder->decode((uint16_t *)dest);
+        }
+        if (!ok)
+            return false;
+        if (pace)
+            pace_replay();
+        return true;
+    }
+
+    if (raw_map != NULL) {
+        if (raw_next >= raw_frames) {
+            if (raw_map_length % size)
+                std::cout << "A frame did not reach its full size.\n";
+            return false;
+        }
+        {
+            TRACE_SCOPE("read_raw");
+            memcpy(dest, frame_ptr(raw_next++), size);
+        }
+        if (pace)
+            pace_replay();
+        return true;
+    }
+
+    // A pipe may hand the frame over in pieces
+    int rdsz_ = 0;
+    {
+        TRACE_SCOPE("read_raw");
+        while (rdsz_ < size) {
+            ssize_t r = read(fd, (unsigned char *)(dest) + rdsz_, size - rdsz_);
+            if (r == -1 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                break;
+            rdsz_ += r;
+        }
+    }
+
+    if (pace)
+        pace_replay();
 
     if(rdsz_ < size) {
         std::cout << "A frame did not reach its full size.\n";
@@ -266,39 +470,97 @@ int dev_handler::read_v4l2_frame(void * dest) {
         break;
 
     case IO_METHOD_MMAP:
-        CLEAR(buf);
+    case IO_METHOD_USERPTR:
+    case IO_METHOD_DMABUF:
+        if (!dequeue_frame(&buf))
+            return 0;
 
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_MMAP;
+        //process_image(buffers[buf.index].start, buf.bytesused);
+        sync_buffer(buf.index, true);
+        memcpy(dest, buffers[buf.index].start, buf.bytesused);
+        sync_buffer(buf.index, false);
+        // The zero-copy path (acquire_frame()) avoids this copy.
 
-        if (-1 == xioctl(fd, VIDIOC_DQBUF, &buf)) {
-            switch (errno) {
-            case EAGAIN:
-                    return 0;
+        queue_buffer(buf.index);
+        break;
+    }
 
-            case EIO:
-                    /* Could ignore EIO, see spec. */
+    return 1;
+}
 
-                    /* fall through */
+int dev_handler::dequeue_buffer(struct v4l2_buffer * buf) {
+    CLEAR(*buf);
 
-            default:
-                    errno_exit("VIDIOC_DQBUF");
-            }
+    buf->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf->memory = io_method == IO_METHOD_USERPTR ? V4L2_MEMORY_USERPTR
+                : io_method == IO_METHOD_DMABUF ? V4L2_MEMORY_DMABUF
+                : V4L2_MEMORY_MMAP;
+
+    if (-1 == xioctl(fd, VIDIOC_DQBUF, buf)) {
+        switch (errno) {
+        case EAGAIN:
+                return 0;
+
+        case EIO:
+                /* Could ignore EIO, see spec. */
+
+                /* fall through */
+
+        default:
+                errno_exit("VIDIOC_DQBUF");
         }
+    }
 
-        assert(buf.index < BUF_COUNT);
+    assert(buf->index < buf_count);
+    return 1;
+}
 
-        //process_image(buffers[buf.index].start, buf.bytesused);
-        memcpy(dest, buffers[buf.index].start, buf.bytesused);
-        //FIXME?: memcpy is probably throwing the benefit of mmap outta the window,
-        //but let's consider it later...
+// FIFO dequeue, or with latest_only, drain whatever else is ready and keep
+// only the newest; the older ones go straight back to the driver.
+int dev_handler::dequeue_frame(struct v4l2_buffer * buf) {
+    TRACE_SCOPE("dequeue");
+
+    if (!dequeue_buffer(buf))
+        return 0;
+
+    if (latest_only) {
+        struct v4l2_buffer next;
+        while (dequeue_buffer(&next)) {
+            queue_buffer(buf->index);
+            *buf = next;
+            skipped++;
+        }
+    }
+    return 1;
+}
+
+void dev_handler::queue_buffer(unsigned int index) {
+    struct v4l2_buffer buf;
+
+    CLEAR(buf);
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.index = index;
+
+    switch (io_method) {
+    case IO_METHOD_MMAP:
+        buf.memory = V4L2_MEMORY_MMAP;
+        break;
+
+    case IO_METHOD_USERPTR:
+        buf.memory = V4L2_MEMORY_USERPTR;
+        buf.m.userptr = (unsigned long)buffers[index].start;
+        buf.length = buffers[index].length;
+        break;
 
-        if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
-                errno_exit("VIDIOC_QBUF");
+    case IO_METHOD_DMABUF:
+        buf.memory = V4L2_MEMORY_DMABUF;
+        buf.m.fd = buffers[index].dmabuf_fd;
+        buf.length = buffers[index].length;
         break;
     }
 
-    return 1;
+    if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
+        errno_exit("VIDIOC_QBUF");
 }
 
 void dev_handler::stop_capturing(void) {
@@ -310,6 +572,8 @@ void dev_handler::stop_capturing(void) {
         break;
 
     case IO_METHOD_MMAP:
+    case IO_METHOD_USERPTR:
+    case IO_METHOD_DMABUF:
         type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
         if (-1 == xioctl(fd, VIDIOC_STREAMOFF, &type))
             errno_exit("VIDIOC_STREAMOFF");
@@ -326,9 +590,18 @@ void dev_handler::uninit_device(void) {
         break;
 
     case IO_METHOD_MMAP:
-        for (i = 0; i < BUF_COUNT; ++i)
+    case IO_METHOD_DMABUF:
+        for (i = 0; i < buf_count; ++i) {
             if (-1 == munmap(buffers[i].start, buffers[i].length))
                 errno_exit("munmap");
+            if (buffers[i].dmabuf_fd != -1)
+                close(buffers[i].dmabuf_fd);
+        }
+        break;
+
+    case IO_METHOD_USERPTR:
+        for (i = 0; i < buf_count; ++i)
+            free(buffers[i].start);
         break;
     }
 
@@ -360,28 +633,18 @@ void dev_handler::start_capturing(void) {
     if (io_method == IO_METHOD_READ)
         return;
 
-    for (int i = 0; i < BUF_COUNT; ++i) {
-        struct v4l2_buffer buf;
-
-        CLEAR(buf);
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_MMAP;
-        buf.index = i;
-
-        if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
-            errno_exit("VIDIOC_QBUF");
-    }
+    for (unsigned int i = 0; i < buf_count; ++i)
+        queue_buffer(i);
     type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     if (-1 == xioctl(fd, VIDIOC_STREAMON, &type))
         errno_exit("VIDIOC_STREAMON");
     capturing = true;
 }
 
-bool dev_handler::read_frame_file(void * dest) {
-    if(is_dev == false)
-        return read_raw(dest);
+void dev_handler::wait_for_frame(void) {
+    TRACE_SCOPE("select");
 
-    do {
+    for (;;) {
         fd_set fds;
         struct timeval tv;
         int r;
@@ -405,7 +668,60 @@ bool dev_handler::read_frame_file(void * dest) {
                 fprintf(stderr, "select timeout\n");
                 exit(EXIT_FAILURE);
         }
+        return;
+    }
+}
+
+bool dev_handler::read_frame_file(void * dest) {
+    if(is_dev == false)
+        return read_raw(dest);
+
+    do {
+        wait_for_frame();
     } while (!read_v4l2_frame(dest));
     return true;
 }
 
+bool dev_handler::try_read_frame(void * dest) {
+    if (is_dev == false)
+        return read_raw(dest, false);
+
+    return read_v4l2_frame(dest);
+}
+
+int dev_handler::frame_period_ns(void) {
+    if (fps == 0)
+        return 2000000000;
+    if (fps < 0)
+        return 0;
+    return 1000000000 / fps;
+}
+
+const void * dev_handler::acquire_frame(void) {
+    assert(can_zero_copy());
+    assert(!holding);
+
+    if (!is_dev) {
+        if (raw_next >= raw_frames)
+            return NULL;
+        pace_replay();
+        return frame_ptr(raw_next++);
+    }
+
+    do {
+        wait_for_frame();
+    } while (!dequeue_frame(&held));
+
+    holding = true;
+    sync_buffer(held.index, true);
+    return buffers[held.index].start;
+}
+
+void dev_handler::release_frame(void) {
+    if (!holding)
+        return;
+
+    sync_buffer(held.index, false);
+    queue_buffer(held.index);
+    holding = false;
+}
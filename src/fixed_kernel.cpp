@@ -0,0 +1,65 @@
+#include "fixed_kernel.hpp"
+
+// Digit-by-digit square root, floor(sqrt(x)).
+// Shifts, adds and compares only; no multiply, no divide.
+uint32_t isqrt64(uint64_t x) {
+    if (x == 0)
+        return 0;
+
+    uint64_t res = 0;
+    // highest power of four <= x
+    uint64_t bit = 1ULL << ((63 - __builtin_clzll(x)) & ~1);
+
+    while (bit != 0) {
+        if (x >= res + bit) {
+            x -= res + bit;
+            res = (res >> 1) + bit;
+        } else {
+            res >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)res;
+}
+
+// x in K^4 -> To in centi-Kelvin, rounded.
+// sqrt(x * 2^20) = To^2 * 2^10, sqrt(that * 2^22) = To * 2^16.
+static inline int32_t root4_cK(int64_t x) {
+    if (x <= 0)
+        return 0;
+    uint64_t To2 = isqrt64((uint64_t)x << 20);
+    uint64_t To_q16 = isqrt64(To2 << 22);
+    return (int32_t)((To_q16 * 100 + (1 << 15)) >> 16);
+}
+
+void fixed_kernel(const fixed_kernel_args & args) {
+    const int K_Ta_scale = args.K_Ta_scale;
+
+    for (int row = 0; row < 24; row++) {
+        for (int col = 0; col < 32; col++) {
+            int thispixel = row * 32 + col;
+            if (args.extended &&
+                    (row + col) % 2 != args.subpage)
+                    // discrepancy from datasheet: datasheet is 1-based index
+                    // also we're assuming checkerboard pattern
+                continue;
+
+            if (args.inv_a[thispixel] == 0) {
+                args.To_cK[thispixel] = 0;
+                continue;
+            }
+
+            // 1 + K_Ta * dTa, Q16
+            int64_t K_Ta_dTa = (1 << 16)
+                + (((int64_t)args.K_Ta[thispixel] * args.dTa) >> K_Ta_scale);
+            // offset_ref * (1 + K_Ta * dTa) * (1 + K_V * dV), Q16
+            int64_t offset = ((int64_t)args.offset_ref[thispixel] * K_Ta_dTa
+                              * args.K_V_dV[row%2][col%2]) >> 16;
+            // Q8
+            int64_t pix = ((int64_t)args.ram_PIX[thispixel] * args.gain - offset) >> 8;
+
+            int64_t x = ((pix * args.inv_a[thispixel]) >> (8 + FIXED_INV_A_SHIFT)) + args.T_ar;
+            args.To_cK[thispixel] = root4_cK(x);
+        }
+    }
+}
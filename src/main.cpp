@@ -1,6 +1,8 @@
 #include <iostream>
+#include <algorithm>
 #include <cstdio>
 #include <cfloat>
+#include <vector>
 #include <fcntl.h>
 #include <unistd.h>
 #include <endian.h>
@@ -11,8 +13,15 @@
 #include "mlx90640.hpp"
 #include "dev_handler.hpp"
 #include "push_data.hpp"
+#include "pipeline.hpp"
+#include "multi_sensor.hpp"
+#include "batch.hpp"
+#include "trace.hpp"
+#include "metrics.hpp"
+#include "recorder.hpp"
+#include "recording.hpp"
 
-static const char short_options[] = "d:n:hmrf:S:R:CXt:x:";
+static const char short_options[] = "d:n:hmruDb:Lf:S:R:ZW:T:CXt:x:k:Fo:IcPB:j:O:M:";
 
 static const struct option
 long_options[] = {
@@ -21,13 +30,30 @@ long_options[] = {
     { "help",       no_argument,        NULL, 'h' },
     { "mmap",       no_argument,        NULL, 'm' },
     { "read",       no_argument,        NULL, 'r' },
+    { "userptr",    no_argument,        NULL, 'u' },
+    { "dmabuf",     no_argument,        NULL, 'D' },
+    { "buffers",    required_argument,  NULL, 'b' },
+    { "latest",     no_argument,        NULL, 'L' },
     { "fps",        required_argument,  NULL, 'f' },
     { "save",       required_argument,  NULL, 'S' },
     { "save-raw",   required_argument,  NULL, 'R' },
+    { "compress-raw", no_argument,      NULL, 'Z' },
+    { "record",     required_argument,  NULL, 'W' },
+    { "start",      required_argument,  NULL, 'T' },
     { "ignore-EE-check",  no_argument,  NULL, 'C' },
     { "extended-format",  no_argument,  NULL, 'X' },
     { "interp-type", required_argument, NULL, 't' },
     { "interp-ratio", required_argument, NULL, 'x' },
+    { "kernel",     required_argument,  NULL, 'k' },
+    { "float",      no_argument,        NULL, 'F' },
+    { "root",       required_argument,  NULL, 'o' },
+    { "fixed",      no_argument,        NULL, 'I' },
+    { "copy",       no_argument,        NULL, 'c' },
+    { "pipeline",   no_argument,        NULL, 'P' },
+    { "batch",      required_argument,  NULL, 'B' },
+    { "jobs",       required_argument,  NULL, 'j' },
+    { "sink",       required_argument,  NULL, 'O' },
+    { "metrics",    required_argument,  NULL, 'M' },
     { 0, 0, 0, 0 }
 };
 
@@ -39,22 +65,65 @@ static void usage(FILE *fp, int, char**argv)
             "[Generic]\n"
             "-h | --help                Print this message\n"
             "-R | --save-raw PATH       Save raw data from the device to PATH\n"
+            "-Z | --compress-raw        Write --save-raw losslessly compressed, ~1/3 the size\n"
+            "               Replays with -d like any raw file, -X is not needed.\n"
+            "-W | --record PATH         Record raw frames to PATH with the EE and timestamps\n"
+            "               Replays with -d alone: no -n or -X needed. A recording cut\n"
+            "               short still replays, without its timestamps.\n"
+            "-T | --start SECONDS       Replay a --record recording from SECONDS after its\n"
+            "               first frame, found through its timestamp index\n"
             "-S | --save PATH           Save raw video feed to PATH\n"
             "               (Post-processed, Min-max mapped, gray16-le)\n"
+            "-O | --sink SINK           Where the frames go [default: display]\n"
+            "               display: scaled heat map window, needs OpenGL\n"
+            "               fake: discard, e.g. to measure throughput\n"
+            "               file:PATH: GRAY16 frames to PATH, like --save\n"
+            "               The last two need no display and skip the overlays.\n"
+            "-P | --pipeline            Capture, compute and output on separate threads\n"
+            "               A device feed drops frames rather than stall the sensor.\n"
+            "-M | --metrics ADDR        Serve Prometheus metrics over HTTP at ADDR\n"
+            "               PORT: on 127.0.0.1:PORT, unix:PATH: on a UNIX socket\n"
+            "               Frame counts, drops, stage latencies, Ta/Vdd, min/max.\n"
             "[Data Source]\n"
             "-d | --device PATH         [REQUIRED] Video device file path\n"
             "               If the file appear to be not a device file,\n"
             "               then the program will fall back to raw file read.\n"
             "-n | --nvram PATH          [REQUIRED] NVRAM file path\n"
+            "               Not needed when every -d is a --record recording.\n"
+            "               Give several -d/-n pairs to run one sensor per pair from a\n"
+            "               single thread. --save, --save-raw and --record then write\n"
+            "               PATH.0, PATH.1...\n"
+            "               and --pipeline and --copy do not apply.\n"
             "-C | --ignore-EE-check     Skip NVRAM validity check\n"
             "-f | --fps                 Set feed update frequency [default: 4FPS]\n"
             "               If device is a raw file and fps is not given or -1,\n"
             "               then the file will be processed as fast as possible.\n"
+            "-k | --kernel NAME         Pixel compensation kernel [default: auto]\n"
+            "               One of auto, scalar, sse4, avx2, neon.\n"
+            "               \"auto\" picks the fastest one the CPU supports.\n"
+            "-F | --float               Single precision compensation\n"
+            "               Check the error on your recordings with mlx90640_bench -a.\n"
+            "-o | --root METHOD         Fourth root for To [default: pow]\n"
+            "               One of pow, sqrt, newton. See fourth_root.hpp for errors.\n"
+            "               Vector kernels always use sqrt in place of pow.\n"
+            "-I | --fixed               Integer-only compensation, for FPU-less boards\n"
+            "               Overrides -k, -F and -o.\n"
             "V4L2 only:\n"
             "-m | --mmap                Use memory mapped buffers [default]\n"
             "-r | --read                Use read() calls\n"
+            "-u | --userptr             Let the driver fill our own page-aligned buffers\n"
+            "-D | --dmabuf              Let the driver fill dma-bufs from " DMA_HEAP_PATH "\n"
+            "-b | --buffers N           Capture ring depth, 2 to %d [default: %d]\n"
+            "-L | --latest              Only process the newest ready frame\n"
+            "               Older ones are dropped and counted, for the lowest latency.\n"
+            "-c | --copy                Copy each frame out of the capture buffer\n"
+            "               By default frames are processed in place and the\n"
+            "               buffer is given back to the driver afterwards.\n"
             "Raw file read only:\n"
             "-X | --extended-format     Treat the file as 27 lines per frame\n"
+            "-B | --batch PATH          Convert the whole file to PATH and exit, no display\n"
+            "               Same output as --save, computed on all CPUs.\n"
+            "-j | --jobs N              Worker threads for --batch [default: one per CPU]\n"
             "[GStreamer videoscale options]\n"
             "Note: This program does not relay over GStreamer arguments. However,\n"
             "      environement variables still apply.\n"
@@ -68,7 +137,7 @@ static void usage(FILE *fp, int, char**argv)
             "-x | --interp-ratio        Scale factor of firsthand scaling [default: 7]\n"
             "               The width and height both will be multiplied with this factor\n"
             "",
-            argv[0]);
+            argv[0], VIDEO_MAX_FRAME, BUF_COUNT);
 }
 
 int main(int argc, char **argv) {
@@ -77,6 +146,9 @@ int main(int argc, char **argv) {
 
     char * dev_name = NULL;
     char * nv_name = NULL;
+    // all of them, more than one pair means multi-sensor mode
+    std::vector<char *> dev_names;
+    std::vector<char *> nv_names;
 
     char * fps_ = NULL;
     int fps = -1;
@@ -85,6 +157,9 @@ int main(int argc, char **argv) {
     char * save_path = NULL;
     bool save_raw = false;
     char * save_raw_path = NULL;
+    bool compress_raw = false;
+    char * record_path = NULL;
+    double start = 0;
 
     int io_method = dev_handler::IO_METHOD_MMAP;
     bool ignore_ee_check = false;
@@ -93,6 +168,19 @@ int main(int argc, char **argv) {
     int interp_type = 7;
     int interp_ratio = 7;
 
+    char * kernel_name = NULL;
+    bool single_precision = false;
+    root_method root = ROOT_POW;
+    bool fixed_point = false;
+    bool copy_frames = false;
+    bool pipelined = false;
+    char * batch_path = NULL;
+    int jobs = 0;
+    gst_sink_config sink = { SINK_DISPLAY, NULL, NULL, NULL };
+    char * metrics_address = NULL;
+    int buf_count = BUF_COUNT;
+    bool latest_only = false;
+
     for (;;) {
         int idx;
         int c;
@@ -108,11 +196,15 @@ int main(int argc, char **argv) {
             break;
 
         case 'd':
-            dev_name = optarg;
+            if (dev_name == NULL)
+                dev_name = optarg;
+            dev_names.push_back(optarg);
             break;
 
         case 'n':
-            nv_name = optarg;
+            if (nv_name == NULL)
+                nv_name = optarg;
+            nv_names.push_back(optarg);
             break;
 
         case 'h':
@@ -128,6 +220,26 @@ int main(int argc, char **argv) {
             io_method = dev_handler::IO_METHOD_READ;
             break;
 
+        case 'u':
+            io_method = dev_handler::IO_METHOD_USERPTR;
+            break;
+
+        case 'D':
+            io_method = dev_handler::IO_METHOD_DMABUF;
+            break;
+
+        case 'b':
+            buf_count = atoi(optarg);
+            if (buf_count < 2 || buf_count > VIDEO_MAX_FRAME) {
+                fprintf(stderr, "Buffer count must be 2 to %d\n", VIDEO_MAX_FRAME);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'L':
+            latest_only = true;
+            break;
+
         case 'f':
             fps_ = optarg;
             fps = (int)std::stof(fps_);
@@ -143,6 +255,18 @@ int main(int argc, char **argv) {
             save_raw_path = optarg;
             break;
 
+        case 'Z':
+            compress_raw = true;
+            break;
+
+        case 'W':
+            record_path = optarg;
+            break;
+
+        case 'T':
+            start = std::stod(optarg);
+            break;
+
         case 'C':
             ignore_ee_check = true;
             break;
@@ -159,6 +283,52 @@ int main(int argc, char **argv) {
             interp_ratio = std::stoi(optarg);
             break;
 
+        case 'k':
+            kernel_name = optarg;
+            break;
+
+        case 'F':
+            single_precision = true;
+            break;
+
+        case 'o':
+            if (!parse_root_method(optarg, &root)) {
+                fprintf(stderr, "Unknown root method: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'I':
+            fixed_point = true;
+            break;
+
+        case 'c':
+            copy_frames = true;
+            break;
+
+        case 'P':
+            pipelined = true;
+            break;
+
+        case 'B':
+            batch_path = optarg;
+            break;
+
+        case 'j':
+            jobs = atoi(optarg);
+            break;
+
+        case 'O':
+            if (!parse_sink(optarg, &sink)) {
+                fprintf(stderr, "Unknown sink: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'M':
+            metrics_address = optarg;
+            break;
+
         default:
             fprintf(stderr, "Unrecognized option: %c\n", c);
             usage(stdout, argc, argv);
@@ -167,43 +337,169 @@ int main(int argc, char **argv) {
         }
     }
 
+    // Recordings carry their own EE
+    if (nv_names.empty() && !dev_names.empty()
+            && std::all_of(dev_names.begin(), dev_names.end(), recording_probe)) {
+        nv_names = dev_names;
+        nv_name = dev_name;
+    }
+
     if (dev_name == NULL || nv_name == NULL) {
         printf("Required option not given\n");
         usage(stdout, argc, argv);
         exit(EXIT_FAILURE);
     }
 
-    device = new dev_handler(io_method, fps, extended_format);
-    device->init_frame_file(dev_name);
+    if (dev_names.size() != nv_names.size()) {
+        printf("Every --device needs its own --nvram\n");
+        exit(EXIT_FAILURE);
+    }
+
+    TRACE_INIT();
+
+    if (metrics_address != NULL && !metrics_start(metrics_address, dev_names.size()))
+        exit(EXIT_FAILURE);
+
+    if (dev_names.size() > 1) {
+        std::vector<sensor_source> sources;
+        for (size_t i = 0; i < dev_names.size(); i++)
+            sources.push_back({ dev_names[i], nv_names[i] });
+
+        multi_sensor_config config;
+        config.io_method = io_method;
+        config.fps = fps;
+        config.extended_format = extended_format;
+        config.ignore_ee_check = ignore_ee_check;
+        config.buf_count = buf_count;
+        config.latest_only = latest_only;
+        config.start = start;
+        config.kernel_name = kernel_name;
+        config.single_precision = single_precision;
+        config.root = root;
+        config.fixed_point = fixed_point;
+        config.interp_type = interp_type;
+        config.interp_ratio = interp_ratio;
+        config.save_path = save ? save_path : nullptr;
+        config.save_raw_path = save_raw ? save_raw_path : nullptr;
+        config.compress_raw = compress_raw;
+        config.record_path = record_path;
+        config.sink = sink;
+
+        run_multi_sensor(sources, config);
+        printf("closing\n");
+        return 0;
+    }
 
     if (!mlx.init_ee(nv_name, ignore_ee_check)) {
         printf("NVMEM initialization error\n");
         exit(EXIT_FAILURE);
     }
 
-    if (gst_init_(interp_type, interp_ratio) != 0) {
+    if (!mlx.set_kernel(kernel_name, single_precision)) {
+        printf("Pixel kernel \"%s\" is not available on this CPU\n", kernel_name);
+        exit(EXIT_FAILURE);
+    }
+    mlx.set_root(root);
+    if (fixed_point)
+        printf("Pixel kernel: fixed point\n");
+    else
+        printf("Pixel kernel: %s (%s, %s%s)\n", mlx.kernel_name(),
+            mlx.kernel_single_precision() ? "float" : "double",
+            root_method_name(mlx.root_used()),
+            mlx.root_used() != root ? ", no pow in this kernel" : "");
+
+    if (batch_path != NULL) {
+        if (start > 0) {
+            printf("--start does not apply to --batch, which converts the whole file\n");
+            exit(EXIT_FAILURE);
+        }
+        batch_config config;
+        batch_stats stats;
+        config.in_path = dev_name;
+        config.out_path = batch_path;
+        config.extended = extended_format;
+        config.fixed_point = fixed_point;
+        config.jobs = jobs > 0 ? jobs : 0;
+        config.chunk_frames = 0;
+
+        mlx.set_extended(extended_format);
+        if (!run_batch(mlx, config, &stats)) {
+            printf("Batch processing failed\n");
+            exit(EXIT_FAILURE);
+        }
+        printf("Batch: %lu frames in %.3f s, %.0f frames/s\n",
+            stats.frames, stats.seconds, stats.frames / stats.seconds);
+        if (stats.counters.too_big || stats.counters.negative)
+            printf("WARNING: clamped %lu too big and %lu negative mapping results\n",
+                stats.counters.too_big, stats.counters.negative);
+        return 0;
+    }
+
+    device = new dev_handler(io_method, fps, extended_format);
+    device->set_buffer_count(buf_count);
+    device->set_latest_only(latest_only);
+    device->init_frame_file(dev_name);
+    if (start > 0 && !device->seek_start(start)) {
+        printf("--start needs a --record recording, '%s' is not one\n", dev_name);
+        exit(EXIT_FAILURE);
+    }
+
+    if (gst_init_(interp_type, interp_ratio, &sink) != 0) {
         printf("Gstreamer initialization error\n");
         exit(EXIT_FAILURE);
     }
 
-    mlx.init_frame_file(device);
+    mlx.init_frame_file(device, !copy_frames && !pipelined);
     gst_start_running();
 
-    uint16_t To_int[0x300];
     uint8_t * dest;
     const mlx90640::notable_pxls_t * pixels = nullptr;
-    FILE* save_LE16_frm;
-    FILE* save_pixel_raw;
-    if (save)
-        save_LE16_frm = fopen(save_path, "wb");
-    if (save_raw)
-        save_pixel_raw = fopen(save_raw_path, "wb");
-
-    while (1) {
-        if (!mlx.process_frame_file()) {
+    recorder rec;
+    if (save || save_raw || record_path != NULL) {
+        recorder_config config;
+        config.gray_path = save ? save_path : NULL;
+        config.raw_path = save_raw ? save_raw_path : NULL;
+        config.record_path = record_path;
+        config.raw_words = device->is_extended() ? 0x360 : 0x340;
+        config.compress_raw = compress_raw;
+        config.ee = mlx.ee_words();
+        config.fps = fps;
+        config.drop = device->is_device();
+        if (!rec.start(config))
+            exit(EXIT_FAILURE);
+    }
+
+    sensor_metrics * metrics = metrics_sensor(0);
+
+    if (pipelined) {
+        pipeline_config config;
+        config.fixed_point = fixed_point;
+        config.metrics = metrics;
+        config.rec = rec.active() ? &rec : nullptr;
+
+        pipeline_stats stats = run_pipeline(mlx, device, config);
+        printf("Pipeline: %lu frames captured, %lu shown, dropped %lu at capture and %lu at compute\n",
+            stats.captured, stats.output, stats.capture_drops, stats.compute_drops);
+    }
+
+    while (!pipelined) {
+        TRACE_POLL();
+        TRACE_SCOPE("frame");
+
+        bool got_frame;
+        {
+            stage_timer timer(metrics, STAGE_READ);
+            got_frame = mlx.process_frame_file();
+        }
+        int64_t timestamp = recording_now();
+        if (!got_frame) {
             printf("Stopping due to file read\n");
             break;
         }
+        if (metrics) {
+            metrics->captured++;
+            metrics->skipped_stale = device->skipped_frames();
+        }
 
         dest = gst_get_userp();
         if (dest == NULL) {
@@ -211,59 +507,53 @@ int main(int argc, char **argv) {
             break;
         }
 
-        mlx.process_frame();
-        mlx.process_pixel();
-
+        {
+            stage_timer timer(metrics, STAGE_PROCESS_FRAME);
+            mlx.process_frame();
+        }
+        {
+            stage_timer timer(metrics, STAGE_PROCESS_PIXEL);
+            if (fixed_point)
+                mlx.process_pixel_fixed_gray16((uint16_t *)dest);
+            else
+                mlx.process_pixel_gray16((uint16_t *)dest);
+        }
         pixels = mlx.pix_notable();
-        // mapping: a(x-b) = range * (x-min) / (max - min)
-        double b = (*pixels)[mlx90640::MIN_T].T;
-        double a = 65535.0 / ((*pixels)[mlx90640::MAX_T].T - (*pixels)[mlx90640::MIN_T].T);
-
-        for (int row = 0; row < 24; row++) {
-            for (int col = 0; col < 32; col++) {
-                double result = a * ((mlx.To_())[row * 32 + col] - b);
-                if (result >= 65536) {  // somehow conversion yielded values bigger than 65535 + DBL_EPSILON, but by miniscule value
-                                        // Int conversion will always round down.
-                    printf("WARNING: mapping result too big\n");
-                    printf("min: %lf, max: %lf, To: %lf, Result: %lf\n",
-                        (*pixels)[mlx90640::MIN_T].T,
-                        (*pixels)[mlx90640::MAX_T].T,
-                        (mlx.To_())[row * 32 + col],
-                        result);
-                    result = 65535;
-                }
-                if (result < 0) {
-                    printf("WARNING: mapping result negative\n");
-                    printf("min: %lf, max: %lf, To: %lf, Result: %lf\n",
-                        (*pixels)[mlx90640::MIN_T].T,
-                        (*pixels)[mlx90640::MAX_T].T,
-                        (mlx.To_())[row * 32 + col],
-                        result);
-                    result = 0;
-                }
-                To_int[row * 32 + col] = result;
-            }
+        if (metrics)
+            metrics->frame_processed(mlx);
+
+        if (rec.active()) {
+            TRACE_SCOPE("save");
+            stage_timer timer(metrics, STAGE_SAVE);
+            if (!rec.record((const uint16_t *)dest, mlx.Pix_Raw_(), timestamp) && metrics)
+                metrics->dropped_recorder++;
         }
-        if (save)
-            fwrite(To_int, sizeof(uint16_t), 0x300, save_LE16_frm);
-        if (save_raw)
-            fwrite(mlx.Pix_Raw_(), sizeof(uint16_t), device->is_extended() ? 0x360 : 0x340, save_pixel_raw);
-
-
-        memcpy(dest, To_int, 0x600);
+        mlx.release_frame();
 
-        if (!gst_arm_buffer(pixels)) {
+        bool pushed;
+        unsigned long dropped = gst_dropped();
+        {
+            stage_timer timer(metrics, STAGE_PUSH);
+            pushed = gst_arm_buffer(pixels);
+        }
+        if (!pushed) {
             printf("Stopping due to Gstreamer frame processing\n");
             break;
         }
+        if (metrics)
+            metrics->frame_pushed(gst_dropped() != dropped);
     }
 
     printf("closing\n");
-    if (save) {
-        fclose(save_LE16_frm);
-    }
-    if (save_raw) {
-        fclose(save_pixel_raw);
+    if (mlx.map_counters_().too_big || mlx.map_counters_().negative)
+        printf("WARNING: clamped %lu too big and %lu negative mapping results\n",
+            mlx.map_counters_().too_big, mlx.map_counters_().negative);
+    if (latest_only)
+        printf("Skipped %lu stale frames\n", device->skipped_frames());
+    if (rec.active()) {
+        recorder_stats rs = rec.stop();
+        if (rs.overflows || rs.errors)
+            printf("WARNING: recording dropped %lu frames, %lu write errors\n", rs.overflows, rs.errors);
     }
 
     gst_cleanup();
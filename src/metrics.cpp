@@ -0,0 +1,358 @@
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cstdarg>
+
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "metrics.hpp"
+
+latency_histogram::latency_histogram() {
+    for (std::atomic<uint64_t> & b : buckets)
+        b = 0;
+    total = 0;
+    sum = 0;
+}
+
+// 0..3 ns get a bucket each, then four per power of two
+static int bucket_of(uint64_t ns) {
+    if (ns < 4)
+        return ns;
+    int msb = 63 - __builtin_clzll(ns);
+    int sub = (ns >> (msb - 2)) & 3;
+    int b = 4 * (msb - 1) + sub;
+    return b < LATENCY_BUCKETS ? b : LATENCY_BUCKETS - 1;
+}
+
+static double bucket_low(int b) {
+    if (b < 4)
+        return b;
+    return (double)(4 + b % 4) * (double)(1ull << (b / 4 - 1));
+}
+
+void latency_histogram::record(uint64_t ns) {
+    buckets[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(ns, std::memory_order_relaxed);
+}
+
+double latency_histogram::quantile(double q) const {
+    uint64_t counts[LATENCY_BUCKETS];
+    uint64_t n = 0;
+    // Summed from the buckets rather than total, so a scrape racing with
+    // record() is still consistent with itself
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        counts[b] = buckets[b].load(std::memory_order_relaxed);
+        n += counts[b];
+    }
+    if (n == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)(q * (n - 1)) + 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += counts[b];
+        if (seen >= rank) {
+            // Linear within the bucket
+            double low = bucket_low(b);
+            double high = bucket_low(b + 1);
+            double into = (double)(rank - (seen - counts[b])) / counts[b];
+            return low + (high - low) * into;
+        }
+    }
+    return bucket_low(LATENCY_BUCKETS);
+}
+
+sensor_metrics::sensor_metrics() {
+    captured = 0;
+    processed = 0;
+    pushed = 0;
+    dropped_backpressure = 0;
+    dropped_capture = 0;
+    dropped_compute = 0;
+    dropped_recorder = 0;
+    skipped_stale = 0;
+    clamped_too_big = 0;
+    clamped_negative = 0;
+    Ta = 0;
+    Vdd = 0;
+    T_min = 0;
+    T_max = 0;
+}
+
+void sensor_metrics::frame_processed(mlx90640_frame & frame) {
+    const mlx90640_frame::notable_pxls_t & notable = *frame.pix_notable();
+
+    processed.fetch_add(1, std::memory_order_relaxed);
+    Ta.store(frame.Ta_(), std::memory_order_relaxed);
+    Vdd.store(frame.Vdd_(), std::memory_order_relaxed);
+    T_min.store(notable[mlx90640_frame::MIN_T].T, std::memory_order_relaxed);
+    T_max.store(notable[mlx90640_frame::MAX_T].T, std::memory_order_relaxed);
+    clamped_too_big.store(frame.map_counters_().too_big, std::memory_order_relaxed);
+    clamped_negative.store(frame.map_counters_().negative, std::memory_order_relaxed);
+}
+
+// The server
+
+static struct {
+    std::vector<sensor_metrics *> sensors;
+    std::thread thread;
+    std::atomic<bool> running;
+    int listen_fd;
+    std::string unix_path;
+} server;
+
+static const char * stage_names[STAGE_COUNT] = {
+    "read",
+    "process_frame",
+    "process_pixel",
+    "save",
+    "push",
+};
+
+static void append(std::string & out, const char * fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void append(std::string & out, const char * fmt, ...) {
+    char line[256];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    out += line;
+}
+
+static void counter(std::string & out, const char * name, const char * help,
+                    std::atomic<unsigned long> sensor_metrics::* field) {
+    append(out, "# HELP mlx90640_%s %s\n# TYPE mlx90640_%s counter\n", name, help, name);
+    for (size_t n = 0; n < server.sensors.size(); n++)
+        append(out, "mlx90640_%s{sensor=\"%zu\"} %lu\n", name, n,
+            (server.sensors[n]->*field).load(std::memory_order_relaxed));
+}
+
+static void gauge(std::string & out, const char * name, const char * help,
+                  std::atomic<double> sensor_metrics::* field) {
+    append(out, "# HELP mlx90640_%s %s\n# TYPE mlx90640_%s gauge\n", name, help, name);
+    for (size_t n = 0; n < server.sensors.size(); n++)
+        append(out, "mlx90640_%s{sensor=\"%zu\"} %.3f\n", name, n,
+            (server.sensors[n]->*field).load(std::memory_order_relaxed));
+}
+
+static std::string render(void) {
+    std::string out;
+
+    counter(out, "frames_captured_total", "Frames read from the source.",
+        &sensor_metrics::captured);
+    counter(out, "frames_processed_total", "Frames compensated and mapped.",
+        &sensor_metrics::processed);
+    counter(out, "frames_pushed_total", "Frames handed to GStreamer.",
+        &sensor_metrics::pushed);
+    counter(out, "frames_dropped_backpressure_total",
+        "Frames discarded while GStreamer asked to stop feeding.",
+        &sensor_metrics::dropped_backpressure);
+    counter(out, "frames_dropped_capture_total", "Frames dropped on a full capture ring.",
+        &sensor_metrics::dropped_capture);
+    counter(out, "frames_dropped_compute_total", "Frames dropped on a full output ring.",
+        &sensor_metrics::dropped_compute);
+    counter(out, "frames_dropped_recorder_total", "Frames not recorded on a full recorder queue.",
+        &sensor_metrics::dropped_recorder);
+    counter(out, "frames_skipped_stale_total", "Older ready frames skipped by --latest.",
+        &sensor_metrics::skipped_stale);
+    counter(out, "mapping_clamped_too_big_total", "GRAY16 results clamped to 65535.",
+        &sensor_metrics::clamped_too_big);
+    counter(out, "mapping_clamped_negative_total", "GRAY16 results clamped to 0.",
+        &sensor_metrics::clamped_negative);
+
+    gauge(out, "ambient_celsius", "Sensor Ta of the last frame.", &sensor_metrics::Ta);
+    gauge(out, "vdd_volts", "Sensor Vdd of the last frame.", &sensor_metrics::Vdd);
+    gauge(out, "object_min_celsius", "Coldest pixel of the last frame.", &sensor_metrics::T_min);
+    gauge(out, "object_max_celsius", "Hottest pixel of the last frame.", &sensor_metrics::T_max);
+
+    append(out, "# HELP mlx90640_stage_latency_seconds Time spent per frame in each stage.\n"
+                "# TYPE mlx90640_stage_latency_seconds summary\n");
+    for (size_t n = 0; n < server.sensors.size(); n++) {
+        for (int s = 0; s < STAGE_COUNT; s++) {
+            const latency_histogram & h = server.sensors[n]->stage[s];
+            for (double q : { 0.5, 0.99 })
+                append(out, "mlx90640_stage_latency_seconds{sensor=\"%zu\",stage=\"%s\",quantile=\"%g\"} %.9f\n",
+                    n, stage_names[s], q, h.quantile(q) / 1e9);
+            append(out, "mlx90640_stage_latency_seconds_sum{sensor=\"%zu\",stage=\"%s\"} %.9f\n",
+                n, stage_names[s], h.sum_ns() / 1e9);
+            append(out, "mlx90640_stage_latency_seconds_count{sensor=\"%zu\",stage=\"%s\"} %lu\n",
+                n, stage_names[s], (unsigned long)h.count());
+        }
+    }
+    return out;
+}
+
+static bool write_all(int fd, const char * p, size_t len) {
+    while (len > 0) {
+        ssize_t w = write(fd, p, len);
+        if (w == -1 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return false;
+        p += w;
+        len -= w;
+    }
+    return true;
+}
+
+// One request per connection, HTTP/1.0 style. Anything but GET /metrics
+// (or /) is a 404; the headers are read but ignored.
+static void serve(int fd) {
+    char request[1024];
+    size_t len = 0;
+
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    while (len < sizeof(request) - 1 && !memmem(request, len, "\r\n\r\n", 4)) {
+        // Don't let a silent client stall the scrapes behind it
+        if (poll(&pfd, 1, 1000) <= 0)
+            return;
+        ssize_t r = read(fd, request + len, sizeof(request) - 1 - len);
+        if (r <= 0)
+            return;
+        len += r;
+    }
+    request[len] = '\0';
+
+    std::string body;
+    const char * status;
+    if (!strncmp(request, "GET /metrics ", 13) || !strncmp(request, "GET / ", 6)) {
+        status = "200 OK";
+        body = render();
+    } else {
+        status = "404 Not Found";
+        body = "Not found, try /metrics\n";
+    }
+
+    std::string head;
+    append(head, "HTTP/1.0 %s\r\n"
+                 "Content-Type: text/plain; version=0.0.4\r\n"
+                 "Content-Length: %zu\r\n"
+                 "Connection: close\r\n\r\n", status, body.size());
+    if (write_all(fd, head.data(), head.size()))
+        write_all(fd, body.data(), body.size());
+}
+
+static void server_loop(void) {
+    struct pollfd pfd = { server.listen_fd, POLLIN, 0 };
+
+    while (server.running) {
+        // Wakes up now and then to notice metrics_stop()
+        int r = poll(&pfd, 1, 200);
+        if (r <= 0)
+            continue;
+
+        int fd = accept4(server.listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd == -1)
+            continue;
+        serve(fd);
+        close(fd);
+    }
+}
+
+static int listen_unix(const char * path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Metrics: socket path too long: %s\n", path);
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    // A stale socket from an earlier run
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int listen_loopback(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    // Never beyond this machine: there is no authentication
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool metrics_start(const char * address, size_t sensors) {
+    int fd;
+
+    if (!strncmp(address, "unix:", 5)) {
+        server.unix_path = address + 5;
+        fd = listen_unix(server.unix_path.c_str());
+    } else {
+        char * end;
+        long port = strtol(address, &end, 10);
+        if (*address == '\0' || *end != '\0' || port <= 0 || port > 65535) {
+            fprintf(stderr, "Metrics: expected unix:PATH or a port, got '%s'\n", address);
+            return false;
+        }
+        fd = listen_loopback(port);
+    }
+    if (fd == -1 || listen(fd, 8) == -1) {
+        fprintf(stderr, "Metrics: cannot listen on '%s': %d, %s\n",
+                address, errno, strerror(errno));
+        if (fd != -1)
+            close(fd);
+        return false;
+    }
+
+    for (size_t n = 0; n < sensors; n++)
+        server.sensors.push_back(new sensor_metrics);
+    server.listen_fd = fd;
+    server.running = true;
+    server.thread = std::thread(server_loop);
+    // The thread has to be joined before exit() destroys it, from anywhere
+    atexit(metrics_stop);
+    return true;
+}
+
+void metrics_stop(void) {
+    if (!server.running)
+        return;
+
+    server.running = false;
+    server.thread.join();
+    close(server.listen_fd);
+    if (!server.unix_path.empty())
+        unlink(server.unix_path.c_str());
+
+    for (sensor_metrics * m : server.sensors)
+        delete m;
+    server.sensors.clear();
+}
+
+sensor_metrics * metrics_sensor(size_t n) {
+    return n < server.sensors.size() ? server.sensors[n] : nullptr;
+}
@@ -1,6 +1,7 @@
-#include "mlx90640.hpp"
+#include "mlx90640_calibration.hpp"
+#include "recording.hpp"
 
-void mlx90640::print_ee(void) {
+void mlx90640_calibration::print_ee(void) const {
     for (int i=0; i<0x340; i++)
     {
         char buffer[5];
@@ -13,18 +14,27 @@ void mlx90640::print_ee(void) {
     }
 }
 
-bool mlx90640::read_ee(const char * path) {
+bool mlx90640_calibration::read_ee(const char * path) {
     int fd = open(path, O_RDONLY);
     if (fd == -1)
         return false;
-    ssize_t rdsz_ = read(fd, (unsigned char *)(ee.word_),
-        sizeof(ee) / sizeof(char));
+    // A recording has it after its header. pread() leaves the file
+    // offset alone, and fails harmlessly on a pipe.
+    char magic[8];
+    ssize_t rdsz_;
+    if (pread(fd, magic, sizeof(magic), 0) == (ssize_t)sizeof(magic)
+            && memcmp(magic, REC_MAGIC, sizeof(magic)) == 0)
+        rdsz_ = pread(fd, (unsigned char *)(ee.word_),
+            sizeof(ee) / sizeof(char), REC_EE_OFFSET);
+    else
+        rdsz_ = read(fd, (unsigned char *)(ee.word_),
+            sizeof(ee) / sizeof(char));
     close(fd);
     std::cout << "EE: " << rdsz_ << " bytes read\n";
     return true;
 }
 
-unsigned short mlx90640::fetch_EE_address(int address) {
+unsigned short mlx90640_calibration::fetch_EE_address(int address) const {
     const int OFFSET = 0x2400;
 
     if (address < OFFSET || address >= OFFSET + 0x340) {
@@ -34,7 +44,7 @@ unsigned short mlx90640::fetch_EE_address(int address) {
     return le16toh(ee.word_[address - OFFSET]);
 }
 
-bool mlx90640::init_ee(const char * path, bool ignore_ee_check) {
+bool mlx90640_calibration::init_ee(const char * path, bool ignore_ee_check) {
     bool rtn = read_ee(path);
     if (rtn == false) {
         printf("NVMEM read error\n");
@@ -174,6 +184,12 @@ bool mlx90640::init_ee(const char * path, bool ignore_ee_check) {
     K_V[1][0] = (double)ee2434.bf.K_V_rOcE / (double)(1 << K_V_scale);
     K_V[1][1] = (double)ee2434.bf.K_V_rOcO / (double)(1 << K_V_scale);
 
+    fixed.K_V[0][0] = ee2434.bf.K_V_rEcE;
+    fixed.K_V[0][1] = ee2434.bf.K_V_rEcO;
+    fixed.K_V[1][0] = ee2434.bf.K_V_rOcE;
+    fixed.K_V[1][1] = ee2434.bf.K_V_rOcO;
+    fixed.K_V_scale = K_V_scale;
+
     // printf(" == K_Ta <frame> == \n");
     int K_Ta_PIX[0x300];
     for (int i=0; i < 0x300; i++) {
@@ -195,8 +211,10 @@ bool mlx90640::init_ee(const char * path, bool ignore_ee_check) {
             K_Ta[row * 32 + col]
                 = (double)(K_Ta_int)
                   / (double)(1 << K_Ta_scale1);
+            fixed.K_Ta[row * 32 + col] = K_Ta_int;
         }
     }
+    fixed.K_Ta_scale = K_Ta_scale1;
 
     // printf(" == offset == \n");
     int offset_avg = ee.named.PIX_OS_AVG;
@@ -260,6 +278,9 @@ bool mlx90640::init_ee(const char * path, bool ignore_ee_check) {
                 (a_col[col] << a_col_scale) +
                 ((a_rem) << a_rem_scale);
             a_ref[row * 32 + col] = (double)a_ref_int / pow(2, a_scale);
+            fixed.inv_a[row * 32 + col] = a_ref_int > 0
+                ? (uint32_t)((((uint64_t)1 << (a_scale + FIXED_INV_A_SHIFT)) + a_ref_int / 2) / a_ref_int)
+                : 0;
         }
     }
 
@@ -268,77 +289,19 @@ bool mlx90640::init_ee(const char * path, bool ignore_ee_check) {
         printf("Warning: TGC value present, which will be ignored\n");
     //TODO: detect interleave mode and inform the user how lazy of a programmer I am
 
-    return true;
-}
+    build_plan();
 
-unsigned short mlx90640::fetch_RAM_address(int address) {
-    const int OFFSET = 0x400;
-    if (address < OFFSET || address >= OFFSET + 0x340) {
-        printf("bad RAM addr, %d\n", address);
-        return 0;
-    }
-    return le16toh(ram.word_[address - OFFSET]);
-}
-
-unsigned short mlx90640::fetch_reg_address(int address) {
-    const int OFFSET = 0x8000;
-    if (address < OFFSET || address >= OFFSET + 0x20) {
-        printf("bad register addr, %d\n", address);
-        return 0;
-    }
-    return le16toh(ram.word_[address - OFFSET + 0x340]);
-}
-
-void mlx90640::process_frame(void) {
-    dV = (double)(-((int)Vdd_25_EE << 5) + VDD_raw + 16384) / (double) K_Vdd_EE / 32.0;
-    V_PTAT_art = (double)(1 << 18) / (a_PTAT + (double)V_BE / (double)V_PTAT);
-    dTa = (V_PTAT_art / (1.0 + K_V_PTAT * dV) - V_PTAT_25) / K_T_PTAT;
-    gain = (double)gain_ee / (double)gain_ram;
-
-    e = 1;
-    T_ar = std::pow((dTa + 273.15 + 25.0), 4); // assuming emissivity is 1
-
-    if (extended)
-        subpage = fetch_reg_address(0x8000) % 2;
+    return true;
 }
 
-void mlx90640::process_pixel(void) {
-    double t_min = HUGE_VAL;
-    double t_max = -HUGE_VAL;
-
+void mlx90640_calibration::build_plan(void) {
     for (int row = 0; row < 24; row++) {
         for (int col = 0; col < 32; col++) {
             int thispixel = row * 32 + col;
-            if (!extended ||
-                    (row + col) % 2 == subpage) {
-                    // discrepancy from datasheet: datasheet is 1-based index
-                    // also we're assuming checkerboard pattern
-                pix[thispixel]
-                    = (double)ram.named.ram_PIX[thispixel] * gain
-                    - (double)offset_ref[thispixel]
-                      * (1 + K_Ta[thispixel] * dTa)
-                      * (1 + K_V[row%2][col%2] * dV);
-                To[thispixel] = pow((pix[thispixel] / a_ref[thispixel] + T_ar), 0.25) - 273.15;
-            }
-
-            // min/max calculation has to be done whole frame regardless of subpage
-            if (To[thispixel] < t_min) {
-                t_min = To[thispixel];
-                pix_list[MIN_T].x = col;
-                pix_list[MIN_T].y = row;
-                pix_list[MIN_T].T = To[thispixel];
-            }
-
-            if (To[thispixel] > t_max) {
-                t_max = To[thispixel];
-                pix_list[MAX_T].x = col;
-                pix_list[MAX_T].y = row;
-                pix_list[MAX_T].T = To[thispixel];
-            }
+            plan.inv_a[thispixel] = 1.0 / a_ref[thispixel];
+            plan.off_a[thispixel] = (double)offset_ref[thispixel] / a_ref[thispixel];
+            plan.off_K_Ta_a[thispixel] = (double)offset_ref[thispixel] * K_Ta[thispixel] / a_ref[thispixel];
+            plan.K_V[thispixel] = K_V[row%2][col%2];
         }
     }
-
-    pix_list[SCENE_CENTER].x = 16;
-    pix_list[SCENE_CENTER].y = 12;
-    pix_list[SCENE_CENTER].T = To[12 * 32 + 16];
 }
@@ -0,0 +1,222 @@
+#include "mlx90640_frame.hpp"
+#include "trace.hpp"
+
+unsigned short mlx90640_frame::fetch_RAM_address(int address) {
+    const int OFFSET = 0x400;
+    if (address < OFFSET || address >= OFFSET + 0x340) {
+        printf("bad RAM addr, %d\n", address);
+        return 0;
+    }
+    return le16toh(frame()->word_[address - OFFSET]);
+}
+
+unsigned short mlx90640_frame::fetch_reg_address(int address) {
+    const int OFFSET = 0x8000;
+    if (address < OFFSET || address >= OFFSET + 0x20) {
+        printf("bad register addr, %d\n", address);
+        return 0;
+    }
+    return le16toh(frame()->word_[address - OFFSET + 0x340]);
+}
+
+void mlx90640_frame::process_frame(void) {
+    TRACE_SCOPE("process_frame");
+
+    dV = (double)(-((int)calib->Vdd_25_EE << 5) + VDD_raw + 16384) / (double) calib->K_Vdd_EE / 32.0;
+    V_PTAT_art = (double)(1 << 18) / (calib->a_PTAT + (double)V_BE / (double)V_PTAT);
+    dTa = (V_PTAT_art / (1.0 + calib->K_V_PTAT * dV) - calib->V_PTAT_25) / calib->K_T_PTAT;
+    gain = (double)calib->gain_ee / (double)gain_ram;
+
+    e = 1;
+    double T_a = dTa + 273.15 + 25.0;
+    T_ar = (T_a * T_a) * (T_a * T_a); // assuming emissivity is 1
+
+    if (extended)
+        subpage = fetch_reg_address(0x8000) % 2;
+}
+
+// pix / a_ref + T_ar
+//  = raw * gain / a_ref
+//    - offset_ref / a_ref * (1 + K_Ta * dTa) * (1 + K_V * dV) + T_ar
+//  = raw * scale + bias
+// Done by process_pixel() only: the reference and fixed point paths never
+// read the plan, and the latter must not pay for it in soft-float.
+void mlx90640_frame::fold_plan(void) {
+    TRACE_SCOPE("fold_plan");
+    plan_folds++;
+    for (int i = 0; i < 0x300; i++) {
+        folded.scale[i] = gain * calib->plan.inv_a[i];
+        folded.bias[i] = T_ar
+            - (calib->plan.off_a[i] + calib->plan.off_K_Ta_a[i] * dTa) * (1 + calib->plan.K_V[i] * dV);
+    }
+
+    if (!kernel.single_precision)
+        return;
+    for (int i = 0; i < 0x300; i++) {
+        folded.scale_f[i] = (float)folded.scale[i];
+        folded.bias_f[i] = (float)folded.bias[i];
+    }
+}
+
+void mlx90640_frame::process_pixel(void) {
+    TRACE_SCOPE("process_pixel");
+
+    fold_plan();
+
+    pixel_kernel_args args;
+    args.ram_PIX = frame()->named.ram_PIX;
+    args.scale = folded.scale;
+    args.bias = folded.bias;
+    args.scale_f = folded.scale_f;
+    args.bias_f = folded.bias_f;
+    args.extended = extended;
+    args.subpage = subpage;
+    args.root = root;
+    args.To = To;
+
+    kernel.fn(args);
+
+    find_notable();
+}
+
+void mlx90640_frame::process_pixel_reference(void) {
+    for (int row = 0; row < 24; row++) {
+        for (int col = 0; col < 32; col++) {
+            int thispixel = row * 32 + col;
+            if (!extended ||
+                    (row + col) % 2 == subpage) {
+                    // discrepancy from datasheet: datasheet is 1-based index
+                    // also we're assuming checkerboard pattern
+                pix[thispixel]
+                    = (double)frame()->named.ram_PIX[thispixel] * gain
+                    - (double)calib->offset_ref[thispixel]
+                      * (1 + calib->K_Ta[thispixel] * dTa)
+                      * (1 + calib->K_V[row%2][col%2] * dV);
+                To[thispixel] = pow((pix[thispixel] / calib->a_ref[thispixel] + T_ar), 0.25) - 273.15;
+            }
+        }
+    }
+
+    find_notable();
+}
+
+// Frame constants are still derived in double, once per frame;
+// only the per-pixel work is integer.
+void mlx90640_frame::process_pixel_fixed(void) {
+    TRACE_SCOPE("process_pixel_fixed");
+
+    fixed_kernel_args args;
+    args.ram_PIX = frame()->named.ram_PIX;
+    args.offset_ref = calib->offset_ref;
+    args.K_Ta = calib->fixed.K_Ta;
+    args.inv_a = calib->fixed.inv_a;
+    args.K_Ta_scale = calib->fixed.K_Ta_scale;
+
+    args.gain = (int32_t)lround(gain * (1 << 16));
+    args.dTa = (int32_t)lround(dTa * (1 << 16));
+    int32_t dV_q16 = (int32_t)lround(dV * (1 << 16));
+    for (int r = 0; r < 2; r++)
+        for (int c = 0; c < 2; c++)
+            args.K_V_dV[r][c] = (1 << 16)
+                + (int32_t)(((int64_t)calib->fixed.K_V[r][c] * dV_q16) >> calib->fixed.K_V_scale);
+    args.T_ar = llround(T_ar);
+
+    args.extended = extended;
+    args.subpage = subpage;
+    args.To_cK = To_cK;
+
+    fixed_kernel(args);
+
+    int cK_min = INT32_MAX;
+    int cK_max = INT32_MIN;
+    for (int row = 0; row < 24; row++) {
+        for (int col = 0; col < 32; col++) {
+            int thispixel = row * 32 + col;
+
+            if (To_cK[thispixel] < cK_min) {
+                cK_min = To_cK[thispixel];
+                pix_list[MIN_T].x = col;
+                pix_list[MIN_T].y = row;
+            }
+
+            if (To_cK[thispixel] > cK_max) {
+                cK_max = To_cK[thispixel];
+                pix_list[MAX_T].x = col;
+                pix_list[MAX_T].y = row;
+            }
+        }
+    }
+    To_cK_min = cK_min;
+    To_cK_max = cK_max;
+
+    pix_list[MIN_T].T = cK_min / 100.0 - 273.15;
+    pix_list[MAX_T].T = cK_max / 100.0 - 273.15;
+    pix_list[SCENE_CENTER].x = 16;
+    pix_list[SCENE_CENTER].y = 12;
+    pix_list[SCENE_CENTER].T = To_cK[12 * 32 + 16] / 100.0 - 273.15;
+}
+
+void mlx90640_frame::find_notable(void) {
+    double t_min = HUGE_VAL;
+    double t_max = -HUGE_VAL;
+
+    // min/max calculation has to be done whole frame regardless of subpage
+    for (int row = 0; row < 24; row++) {
+        for (int col = 0; col < 32; col++) {
+            int thispixel = row * 32 + col;
+
+            if (To[thispixel] < t_min) {
+                t_min = To[thispixel];
+                pix_list[MIN_T].x = col;
+                pix_list[MIN_T].y = row;
+                pix_list[MIN_T].T = To[thispixel];
+            }
+
+            if (To[thispixel] > t_max) {
+                t_max = To[thispixel];
+                pix_list[MAX_T].x = col;
+                pix_list[MAX_T].y = row;
+                pix_list[MAX_T].T = To[thispixel];
+            }
+        }
+    }
+
+    pix_list[SCENE_CENTER].x = 16;
+    pix_list[SCENE_CENTER].y = 12;
+    pix_list[SCENE_CENTER].T = To[12 * 32 + 16];
+}
+
+// mapping: a(x-b) = range * (x-min) / (max - min)
+void mlx90640_frame::map_gray16(uint16_t * dest) {
+    TRACE_SCOPE("map_gray16");
+
+    double b = pix_list[MIN_T].T;
+    double a = 65535.0 / (pix_list[MAX_T].T - pix_list[MIN_T].T);
+    unsigned long too_big = 0;
+    unsigned long negative = 0;
+
+    for (int i = 0; i < 0x300; i++) {
+        double result = a * (To[i] - b);
+        // Rounding can push the max a hair past 65535. Int conversion rounds down.
+        too_big += result >= 65536;
+        negative += !(result >= 0);     // NaN too, e.g. when max == min
+        result = result < 65535 ? result : 65535;
+        result = result >= 0 ? result : 0;
+        dest[i] = (uint16_t)result;
+    }
+
+    counters.too_big += too_big;
+    counters.negative += negative;
+}
+
+// Same mapping in integers: (x-min) * (65535 / (max - min)), the quotient in Q16.
+// Cannot leave 0..65535, so nothing to count.
+void mlx90640_frame::map_gray16_fixed(uint16_t * dest) {
+    TRACE_SCOPE("map_gray16_fixed");
+
+    int32_t range = To_cK_max - To_cK_min;
+    uint64_t a_q16 = range ? ((uint64_t)65535 << 16) / range : 0;
+
+    for (int i = 0; i < 0x300; i++)
+        dest[i] = (uint16_t)(((uint64_t)(To_cK[i] - To_cK_min) * a_q16) >> 16);
+}
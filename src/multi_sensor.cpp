@@ -0,0 +1,280 @@
+#include <string>
+#include <cstdio>
+#include <cstring>
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "multi_sensor.hpp"
+#include "mlx90640.hpp"
+#include "dev_handler.hpp"
+#include "push_data.hpp"
+#include "trace.hpp"
+#include "metrics.hpp"
+#include "recorder.hpp"
+#include "recording.hpp"
+
+#define MAX_EVENTS 16
+
+struct sensor {
+    dev_handler * device;
+    mlx90640 * mlx;
+    gst_stream * stream;
+
+    // The V4L2 fd, or a timerfd pacing a raw file
+    int event_fd;
+    bool timer;
+
+    uint16_t raw[0x360];
+    recorder * rec;     // nullptr: not saving
+    unsigned long frames;
+
+    sensor_metrics * metrics;   // nullptr: metrics off
+};
+
+static std::string numbered(const char * path, size_t n) {
+    return path == nullptr ? std::string() : std::string(path) + "." + std::to_string(n);
+}
+
+static void open_sensor(sensor & s, const sensor_source & src,
+                        const multi_sensor_config & config, size_t n) {
+    s.device = new dev_handler(config.io_method, config.fps, config.extended_format);
+    s.device->set_buffer_count(config.buf_count);
+    s.device->set_latest_only(config.latest_only);
+    s.device->init_frame_file(src.dev_name);
+    if (config.start > 0 && !s.device->seek_start(config.start)) {
+        printf("Sensor %zu: --start needs a --record recording, '%s' is not one\n", n, src.dev_name);
+        exit(EXIT_FAILURE);
+    }
+
+    s.mlx = new mlx90640();
+    if (!s.mlx->init_ee(src.nv_name, config.ignore_ee_check)) {
+        printf("Sensor %zu: NVMEM initialization error\n", n);
+        exit(EXIT_FAILURE);
+    }
+    if (!s.mlx->set_kernel(config.kernel_name, config.single_precision)) {
+        printf("Pixel kernel \"%s\" is not available on this CPU\n", config.kernel_name);
+        exit(EXIT_FAILURE);
+    }
+    s.mlx->set_root(config.root);
+
+    gst_sink_config sink = config.sink;
+    std::string sink_path;
+    if (sink.type == SINK_FILE) {
+        sink_path = std::string(sink.path) + "." + std::to_string(n);
+        sink.path = sink_path.c_str();
+    }
+    s.stream = gst_stream_new(config.interp_type, config.interp_ratio, &sink);
+    if (s.stream == NULL) {
+        printf("Sensor %zu: Gstreamer initialization error\n", n);
+        exit(EXIT_FAILURE);
+    }
+
+    // Frames are read into s.raw; the loop never blocks on one device
+    s.mlx->init_frame_file(s.device, false);
+
+    s.event_fd = s.device->poll_fd();
+    s.timer = s.event_fd == -1;
+    if (s.timer) {
+        struct itimerspec period;
+        long ns = s.device->frame_period_ns();
+        if (ns == 0)
+            ns = 1; // as fast as possible
+
+        s.event_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (s.event_fd == -1) {
+            perror("timerfd_create");
+            exit(EXIT_FAILURE);
+        }
+        CLEAR(period);
+        period.it_interval.tv_sec = ns / 1000000000;
+        period.it_interval.tv_nsec = ns % 1000000000;
+        period.it_value = period.it_interval;
+        if (timerfd_settime(s.event_fd, 0, &period, NULL) == -1) {
+            perror("timerfd_settime");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    s.rec = nullptr;
+    if (config.save_path != nullptr || config.save_raw_path != nullptr
+            || config.record_path != nullptr) {
+        std::string save_path = numbered(config.save_path, n);
+        std::string save_raw_path = numbered(config.save_raw_path, n);
+        std::string record_path = numbered(config.record_path, n);
+        recorder_config rc;
+
+        rc.gray_path = config.save_path ? save_path.c_str() : nullptr;
+        rc.raw_path = config.save_raw_path ? save_raw_path.c_str() : nullptr;
+        rc.record_path = config.record_path ? record_path.c_str() : nullptr;
+        rc.raw_words = s.device->is_extended() ? 0x360 : 0x340;
+        rc.compress_raw = config.compress_raw;
+        rc.ee = s.mlx->ee_words();
+        rc.fps = config.fps;
+        rc.drop = s.device->is_device();
+
+        s.rec = new recorder();
+        if (!s.rec->start(rc))
+            exit(EXIT_FAILURE);
+    }
+    s.frames = 0;
+    s.metrics = metrics_sensor(n);
+}
+
+static void close_sensor(sensor & s) {
+    delete s.rec;
+    if (s.timer)
+        close(s.event_fd);
+
+    gst_stream_free(s.stream);
+    delete s.mlx;
+    delete s.device;
+}
+
+// Handle one readiness event: at most one frame, so a fast source
+// can't starve the others. Returns false once this sensor is done.
+static bool sensor_step(sensor & s, size_t n, const multi_sensor_config & config) {
+    TRACE_SCOPE("sensor_step");
+
+    if (s.timer) {
+        uint64_t expirations;
+        if (read(s.event_fd, &expirations, sizeof(expirations)) == -1)
+            return errno == EAGAIN;
+    }
+
+    bool got_frame;
+    {
+        stage_timer timer(s.metrics, STAGE_READ);
+        got_frame = s.device->try_read_frame(s.raw);
+    }
+    int64_t timestamp = recording_now();
+    if (!got_frame) {
+        if (!s.timer)
+            return true; // spurious wakeup
+        printf("Sensor %zu: stopping due to file read\n", n);
+        return false;
+    }
+    if (s.metrics) {
+        s.metrics->captured++;
+        s.metrics->skipped_stale = s.device->skipped_frames();
+    }
+
+    uint8_t * dest = gst_stream_get_userp(s.stream);
+    if (dest == NULL) {
+        printf("Sensor %zu: stopping due to gstreamer frame init\n", n);
+        return false;
+    }
+
+    s.mlx->view_frame(s.raw);
+    {
+        stage_timer timer(s.metrics, STAGE_PROCESS_FRAME);
+        s.mlx->process_frame();
+    }
+    {
+        stage_timer timer(s.metrics, STAGE_PROCESS_PIXEL);
+        if (config.fixed_point)
+            s.mlx->process_pixel_fixed_gray16((uint16_t *)dest);
+        else
+            s.mlx->process_pixel_gray16((uint16_t *)dest);
+    }
+    if (s.metrics)
+        s.metrics->frame_processed(*s.mlx);
+
+    if (s.rec) {
+        TRACE_SCOPE("save");
+        stage_timer timer(s.metrics, STAGE_SAVE);
+        if (!s.rec->record((const uint16_t *)dest, s.raw, timestamp) && s.metrics)
+            s.metrics->dropped_recorder++;
+    }
+
+    bool pushed;
+    unsigned long dropped = gst_stream_dropped(s.stream);
+    {
+        stage_timer timer(s.metrics, STAGE_PUSH);
+        pushed = gst_stream_arm_buffer(s.stream, s.mlx->pix_notable());
+    }
+    if (!pushed) {
+        printf("Sensor %zu: stopping due to Gstreamer frame processing\n", n);
+        return false;
+    }
+    if (s.metrics)
+        s.metrics->frame_pushed(gst_stream_dropped(s.stream) != dropped);
+    s.frames++;
+    return true;
+}
+
+void run_multi_sensor(const std::vector<sensor_source> & sources,
+                      const multi_sensor_config & config) {
+    std::vector<sensor> sensors(sources.size());
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t n = 0; n < sensors.size(); n++) {
+        struct epoll_event ev;
+
+        open_sensor(sensors[n], sources[n], config, n);
+
+        CLEAR(ev);
+        ev.events = EPOLLIN;
+        ev.data.u32 = n;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, sensors[n].event_fd, &ev) == -1) {
+            perror("epoll_ctl");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (sensor & s : sensors)
+        gst_stream_start(s.stream);
+
+    size_t active = sensors.size();
+    while (active > 0) {
+        struct epoll_event events[MAX_EVENTS];
+        int ready;
+
+        TRACE_POLL();
+        {
+            TRACE_SCOPE("epoll_wait");
+            // Same 2 s as the select() in dev_handler
+            ready = epoll_wait(epfd, events, MAX_EVENTS, 2000);
+        }
+        if (ready == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            exit(EXIT_FAILURE);
+        }
+        if (ready == 0) {
+            fprintf(stderr, "epoll timeout\n");
+            break;
+        }
+
+        for (int i = 0; i < ready; i++) {
+            size_t n = events[i].data.u32;
+            sensor & s = sensors[n];
+
+            if (!sensor_step(s, n, config)) {
+                epoll_ctl(epfd, EPOLL_CTL_DEL, s.event_fd, NULL);
+                active--;
+            }
+        }
+    }
+
+    for (size_t n = 0; n < sensors.size(); n++) {
+        printf("Sensor %zu: %lu frames\n", n, sensors[n].frames);
+        if (config.latest_only)
+            printf("Sensor %zu: skipped %lu stale frames\n", n, sensors[n].device->skipped_frames());
+        if (sensors[n].rec) {
+            recorder_stats rs = sensors[n].rec->stop();
+            if (rs.overflows || rs.errors)
+                printf("Sensor %zu: WARNING: recording dropped %lu frames, %lu write errors\n",
+                    n, rs.overflows, rs.errors);
+        }
+        close_sensor(sensors[n]);
+    }
+    close(epfd);
+}
@@ -0,0 +1,49 @@
+#include <cstring>
+
+#include "notable_meta.hpp"
+
+GType notable_meta_api_get_type(void) {
+    static volatile gsize type = 0;
+    static const gchar *tags[] = { NULL };
+
+    if (g_once_init_enter (&type)) {
+        GType api = gst_meta_api_type_register ("MlxNotableMetaAPI", tags);
+        g_once_init_leave (&type, api);
+    }
+    return type;
+}
+
+static gboolean notable_meta_init(GstMeta *meta, gpointer /*params*/, GstBuffer * /*buffer*/) {
+    notable_meta *m = (notable_meta *)meta;
+    memset (m->pix, 0, sizeof (m->pix));
+    return TRUE;
+}
+
+/* Sensor coordinates: the same for every copy, scale or conversion of the frame */
+static gboolean notable_meta_transform(GstBuffer *dest, GstMeta *meta, GstBuffer * /*buffer*/,
+                                       GQuark /*type*/, gpointer /*data*/) {
+    notable_meta *m = (notable_meta *)meta;
+    return buffer_add_notable_meta (dest, &m->pix) != NULL;
+}
+
+const GstMetaInfo * notable_meta_get_info(void) {
+    static volatile gsize info = 0;
+
+    if (g_once_init_enter (&info)) {
+        const GstMetaInfo *mi = gst_meta_register (NOTABLE_META_API_TYPE, "MlxNotableMeta",
+                sizeof (notable_meta), notable_meta_init, NULL, notable_meta_transform);
+        g_once_init_leave (&info, (gsize)mi);
+    }
+    return (const GstMetaInfo *)info;
+}
+
+notable_meta * buffer_add_notable_meta(GstBuffer *buffer, const mlx90640::notable_pxls_t *pix) {
+    notable_meta *m = (notable_meta *)gst_buffer_add_meta (buffer, NOTABLE_META_INFO, NULL);
+    if (m != NULL)
+        memcpy (m->pix, *pix, sizeof (m->pix));
+    return m;
+}
+
+const notable_meta * buffer_get_notable_meta(GstBuffer *buffer) {
+    return (const notable_meta *)gst_buffer_get_meta (buffer, NOTABLE_META_API_TYPE);
+}
@@ -0,0 +1,158 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "overlay.hpp"
+
+// Just what the readouts need; anything else is drawn as a space
+static const char glyph_chars[] = " 0123456789.-:MAXIND";
+#define GLYPH_COUNT ((int)sizeof(glyph_chars) - 1)
+
+// 5x7, one byte per row, bit 4 is the leftmost column
+static const uint8_t glyph_rows[GLYPH_COUNT][7] = {
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // ' '
+    { 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E },   // 0
+    { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E },   // 1
+    { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F },   // 2
+    { 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E },   // 3
+    { 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 },   // 4
+    { 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E },   // 5
+    { 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E },   // 6
+    { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 },   // 7
+    { 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E },   // 8
+    { 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C },   // 9
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C },   // .
+    { 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 },   // -
+    { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00 },   // :
+    { 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11 },   // M
+    { 0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 },   // A
+    { 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11 },   // X
+    { 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E },   // I
+    { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 },   // N
+    { 0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C },   // D
+};
+
+static int glyph_index(char c) {
+    const char * p = strchr(glyph_chars, c);
+    return (p == NULL || c == '\0') ? 0 : (int)(p - glyph_chars);
+}
+
+// Mark the CLEAR pixels next to a FILL one as OUTLINE
+static void outline(uint8_t * mask, int w, int h, uint8_t clear, uint8_t fill, uint8_t edge) {
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++) {
+            if (mask[y * w + x] != clear)
+                continue;
+            for (int dy = -1; dy <= 1; dy++)
+                for (int dx = -1; dx <= 1; dx++) {
+                    int nx = x + dx, ny = y + dy;
+                    if (nx >= 0 && nx < w && ny >= 0 && ny < h && mask[ny * w + nx] == fill)
+                        mask[y * w + x] = edge;
+                }
+        }
+}
+
+overlay_renderer::overlay_renderer(int scale_ratio) {
+    width = 32 * scale_ratio;
+    height = 24 * scale_ratio;
+    // About the 20 px of the former "Sans, 20" at the usual 480 lines
+    rasterize_glyphs(std::max(1, height / 160));
+    cross_size = std::max(5, scale_ratio);
+    rasterize_cross();
+}
+
+void overlay_renderer::rasterize_glyphs(int s) {
+    // A glyph and a column of spacing, plus a pixel of outline on each side
+    cell_w = 6 * s + 2;
+    cell_h = 7 * s + 2;
+    int atlas_w = cell_w * GLYPH_COUNT;
+    atlas.assign(atlas_w * cell_h, CLEAR);
+
+    for (int g = 0; g < GLYPH_COUNT; g++)
+        for (int row = 0; row < 7; row++)
+            for (int col = 0; col < 5; col++) {
+                if (!(glyph_rows[g][row] & (0x10 >> col)))
+                    continue;
+                for (int y = 0; y < s; y++)
+                    for (int x = 0; x < s; x++)
+                        atlas[(1 + row * s + y) * atlas_w + g * cell_w + 1 + col * s + x] = FILL;
+            }
+    outline(atlas.data(), atlas_w, cell_h, CLEAR, FILL, OUTLINE);
+}
+
+void overlay_renderer::rasterize_cross(void) {
+    int t = std::max(1, cross_size / 10);
+    int c = (cross_size - t) / 2;
+    cross.assign(cross_size * cross_size, CLEAR);
+
+    for (int i = 1; i < cross_size - 1; i++)
+        for (int k = 0; k < t; k++) {
+            cross[(c + k) * cross_size + i] = FILL;
+            cross[i * cross_size + c + k] = FILL;
+        }
+    outline(cross.data(), cross_size, cross_size, CLEAR, FILL, OUTLINE);
+}
+
+void overlay_renderer::blit(uint8_t * pixels, int stride, const overlay_region & r,
+                            const uint8_t * mask, int mask_stride, int w, int h, int x0, int y0) const {
+    static const uint8_t colors[3][4] = { {}, { 0, 0, 0, 255 }, { 255, 255, 255, 255 } };
+
+    // Into the image's own coordinates, clipped to it
+    x0 -= r.x;
+    y0 -= r.y;
+    int x_begin = std::max(0, -x0), x_end = std::min(w, r.w - x0);
+    int y_begin = std::max(0, -y0), y_end = std::min(h, r.h - y0);
+
+    for (int y = y_begin; y < y_end; y++) {
+        // From the first visible column, so no pointer leaves the image when x0 < 0
+        const uint8_t * m = mask + y * mask_stride + x_begin;
+        uint8_t * line = pixels + (size_t)(y0 + y) * stride + (size_t)(x0 + x_begin) * 4;
+        for (int x = 0; x < x_end - x_begin; x++)
+            if (m[x] != CLEAR)
+                memcpy(line + x * 4, colors[m[x]], 4);
+    }
+}
+
+void overlay_renderer::text(uint8_t * pixels, int stride, const overlay_region & r,
+                            const char * str, int x0, int y0) const {
+    int atlas_w = cell_w * GLYPH_COUNT;
+    for (int i = 0; str[i] != '\0'; i++)
+        blit(pixels, stride, r, &atlas[glyph_index(str[i]) * cell_w], atlas_w,
+             cell_w, cell_h, x0 + i * cell_w, y0);
+}
+
+overlay_region overlay_renderer::cross_region(void) const {
+    return { (width - cross_size) / 2, (height - cross_size) / 2, cross_size, cross_size };
+}
+
+// Wide enough for TEXT_CHARS, "MAX: -40.00" is 11; longer readouts lose
+// their left end, as they would at the frame's edge
+#define TEXT_CHARS 14
+
+overlay_region overlay_renderer::text_region(void) const {
+    // Right-aligned in the top right corner, as textoverlay had it
+    int margin = cell_h / 2;
+    int x = std::max(0, width - margin - TEXT_CHARS * cell_w);
+    return { x, margin, width - margin - x, std::min(3 * cell_h, height - margin) };
+}
+
+void overlay_renderer::draw_cross(uint8_t * pixels, int stride) const {
+    overlay_region r = cross_region();
+    blit(pixels, stride, r, cross.data(), cross_size, cross_size, cross_size, r.x, r.y);
+}
+
+void overlay_renderer::draw_text(uint8_t * pixels, int stride, const mlx90640::notable_pxls_t & pix) const {
+    static const struct { const char * label; mlx90640::PIX_NOTE note; } lines[] = {
+        { "MAX", mlx90640::MAX_T },
+        { "MIN", mlx90640::MIN_T },
+        { "MID", mlx90640::SCENE_CENTER },
+    };
+
+    overlay_region r = text_region();
+    int right = r.x + r.w;
+    for (int i = 0; i < 3; i++) {
+        char str[32];
+        int len = snprintf(str, sizeof(str), "%s: %.2lf", lines[i].label, pix[lines[i].note].T);
+        text(pixels, stride, r, str, right - len * cell_w, r.y + i * cell_h);
+    }
+}
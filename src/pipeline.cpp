@@ -0,0 +1,182 @@
+#include <atomic>
+#include <thread>
+#include <cstring>
+
+#include "pipeline.hpp"
+#include "spsc_ring.hpp"
+#include "push_data.hpp"
+#include "trace.hpp"
+#include "recording.hpp"
+
+// Largest frame, 27 lines
+#define RAW_WORDS 0x360
+
+struct raw_slot {
+    uint16_t word[RAW_WORDS];
+    int64_t timestamp;          // recording_now() when read
+};
+
+struct out_slot {
+    // The GRAY16 frame is mapped straight into the buffer that is pushed
+    gst_frame * frame;
+    const uint16_t * gray;      // frame's data, until it is pushed
+    uint16_t raw[RAW_WORDS];    // only filled when recording
+    mlx90640::notable_pxls_t notable;
+    int64_t timestamp;
+
+    out_slot() : frame(gst_frame_new()), gray(nullptr) {}
+    ~out_slot() { gst_frame_free(frame); }
+};
+
+struct pipeline {
+    spsc_ring<raw_slot, PIPELINE_RAW_SLOTS> raw_ring;
+    spsc_ring<out_slot, PIPELINE_OUT_SLOTS> out_ring;
+
+    // Live source: drop on a full ring rather than wait
+    bool drop;
+
+    std::atomic<unsigned long> captured;
+    std::atomic<unsigned long> capture_drops;
+    std::atomic<unsigned long> compute_drops;
+};
+
+static void capture_stage(pipeline & p, dev_handler * device, sensor_metrics * metrics) {
+    raw_slot scratch;
+    TRACE_THREAD_NAME("capture");
+
+    while (!p.raw_ring.is_closed()) {
+        TRACE_SCOPE("capture");
+        raw_slot * slot = p.drop ? p.raw_ring.claim() : p.raw_ring.claim_wait();
+        if (slot == nullptr && !p.drop)
+            break;
+
+        // Dequeue regardless, so the driver never runs out of buffers
+        bool got_frame;
+        {
+            stage_timer timer(metrics, STAGE_READ);
+            got_frame = device->read_frame_file(slot ? slot->word : scratch.word);
+        }
+        if (!got_frame) {
+            printf("Stopping due to file read\n");
+            break;
+        }
+        if (metrics) {
+            metrics->captured++;
+            metrics->skipped_stale = device->skipped_frames();
+        }
+        if (slot == nullptr) {
+            p.capture_drops++;
+            if (metrics)
+                metrics->dropped_capture++;
+            continue;
+        }
+        slot->timestamp = recording_now();
+        p.raw_ring.publish();
+        p.captured++;
+    }
+    p.raw_ring.close();
+}
+
+static void compute_stage(pipeline & p, mlx90640 & mlx, const pipeline_config & config) {
+    sensor_metrics * metrics = config.metrics;
+    raw_slot * in;
+    TRACE_THREAD_NAME("compute");
+
+    while ((in = p.raw_ring.peek_wait()) != nullptr) {
+        TRACE_SCOPE("compute");
+        out_slot * out = p.drop ? p.out_ring.claim() : p.out_ring.claim_wait();
+        if (out == nullptr) {
+            if (p.out_ring.is_closed())
+                break;
+            p.raw_ring.consume();
+            p.compute_drops++;
+            if (metrics)
+                metrics->dropped_compute++;
+            continue;
+        }
+
+        uint16_t * gray = (uint16_t *)gst_map_frame(out->frame);
+        if (gray == nullptr) {
+            printf("Stopping due to gstreamer frame init\n");
+            break;
+        }
+        out->gray = gray;
+
+        mlx.view_frame(in->word);
+        {
+            stage_timer timer(metrics, STAGE_PROCESS_FRAME);
+            mlx.process_frame();
+        }
+        {
+            stage_timer timer(metrics, STAGE_PROCESS_PIXEL);
+            if (config.fixed_point)
+                mlx.process_pixel_fixed_gray16(gray);
+            else
+                mlx.process_pixel_gray16(gray);
+        }
+        if (metrics)
+            metrics->frame_processed(mlx);
+        memcpy(out->notable, *mlx.pix_notable(), sizeof(out->notable));
+        if (config.rec)
+            memcpy(out->raw, in->word, sizeof(out->raw));
+        out->timestamp = in->timestamp;
+
+        p.raw_ring.consume();
+        p.out_ring.publish();
+    }
+    // Also what stops capture if output gave up first
+    p.raw_ring.close();
+    p.out_ring.close();
+}
+
+pipeline_stats run_pipeline(mlx90640 & mlx, dev_handler * device,
+                            const pipeline_config & config) {
+    pipeline * p = new pipeline;
+    pipeline_stats stats = {};
+
+    p->drop = device->is_device();
+    p->captured = 0;
+    p->capture_drops = 0;
+    p->compute_drops = 0;
+
+    std::thread capture(capture_stage, std::ref(*p), device, config.metrics);
+    std::thread compute(compute_stage, std::ref(*p), std::ref(mlx), std::cref(config));
+
+    out_slot * out;
+    while ((out = p->out_ring.peek_wait()) != nullptr) {
+        TRACE_POLL();
+        TRACE_SCOPE("output");
+
+        if (config.rec) {
+            TRACE_SCOPE("save");
+            stage_timer timer(config.metrics, STAGE_SAVE);
+            if (!config.rec->record(out->gray, out->raw, out->timestamp) && config.metrics)
+                config.metrics->dropped_recorder++;
+        }
+
+        bool pushed;
+        unsigned long dropped = gst_dropped();
+        {
+            stage_timer timer(config.metrics, STAGE_PUSH);
+            pushed = gst_push_frame(out->frame, &out->notable);
+        }
+        if (!pushed) {
+            printf("Stopping due to Gstreamer frame processing\n");
+            break;
+        }
+        if (config.metrics)
+            config.metrics->frame_pushed(gst_dropped() != dropped);
+        p->out_ring.consume();
+        stats.output++;
+    }
+    p->out_ring.close();
+
+    compute.join();
+    capture.join();
+
+    stats.captured = p->captured;
+    stats.capture_drops = p->capture_drops;
+    stats.compute_drops = p->compute_drops;
+    delete p;
+    return stats;
+}
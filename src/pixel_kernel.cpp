@@ -0,0 +1,415 @@
+#include <cmath>
+#include <cstring>
+
+#include "pixel_kernel.hpp"
+#include "fourth_root.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// Every kernel is instantiated per root_method; the public entry points
+// switch on args.root once per frame, not per pixel.
+#define DISPATCH_ROOT(impl, args)                   \
+    switch ((args).root) {                          \
+    case ROOT_POW:      impl<ROOT_POW>(args); break; \
+    case ROOT_SQRT:     impl<ROOT_SQRT>(args); break; \
+    case ROOT_NEWTON:   impl<ROOT_NEWTON>(args); break; \
+    }
+
+template<root_method R>
+static void scalar_impl(const pixel_kernel_args & args) {
+    for (int row = 0; row < 24; row++) {
+        for (int col = 0; col < 32; col++) {
+            int thispixel = row * 32 + col;
+            if (args.extended &&
+                    (row + col) % 2 != args.subpage)
+                    // discrepancy from datasheet: datasheet is 1-based index
+                    // also we're assuming checkerboard pattern
+                continue;
+
+            args.To[thispixel] = fourth_root<R>(
+                (double)args.ram_PIX[thispixel] * args.scale[thispixel] + args.bias[thispixel]
+                ) - 273.15;
+        }
+    }
+}
+
+template<root_method R>
+static void scalar_f32_impl(const pixel_kernel_args & args) {
+    for (int row = 0; row < 24; row++) {
+        for (int col = 0; col < 32; col++) {
+            int thispixel = row * 32 + col;
+            if (args.extended &&
+                    (row + col) % 2 != args.subpage)
+                continue;
+
+            float To_K = fourth_root<R>(
+                (float)args.ram_PIX[thispixel] * args.scale_f[thispixel] + args.bias_f[thispixel]);
+            args.To[thispixel] = (double)To_K - 273.15;
+        }
+    }
+}
+
+void pixel_kernel_scalar(const pixel_kernel_args & args) {
+    DISPATCH_ROOT(scalar_impl, args);
+}
+
+void pixel_kernel_scalar_f32(const pixel_kernel_args & args) {
+    DISPATCH_ROOT(scalar_f32_impl, args);
+}
+
+// The vector kernels compute every lane and then blend the result in,
+// so the checkerboard costs a mask instead of a branch per pixel.
+// Lanes of the other subpage may evaluate the root of garbage; they are discarded.
+
+// Lane mask for "this lane belongs to the active subpage", starting at an even column.
+static inline bool lane_active(const pixel_kernel_args & args, int row, int col) {
+    return !args.extended || (row + col) % 2 == args.subpage;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// Fourth roots, see fourth_root.hpp.
+
+__attribute__((target("sse4.1")))
+static inline __m128d root4_pd(__m128d x, root_method R) {
+    if (R != ROOT_NEWTON)
+        return _mm_sqrt_pd(_mm_sqrt_pd(x));
+
+    __m128d r = _mm_castsi128_pd(_mm_sub_epi64(
+        _mm_set1_epi64x(ROOT_NEWTON_MAGIC_F64),
+        _mm_srli_epi64(_mm_castpd_si128(x), 2)));
+    const __m128d x_4 = _mm_mul_pd(x, _mm_set1_pd(0.25));
+    for (int n = 0; n < ROOT_NEWTON_STEPS; n++) {
+        __m128d r2 = _mm_mul_pd(r, r);
+        r = _mm_mul_pd(r, _mm_sub_pd(_mm_set1_pd(1.25), _mm_mul_pd(x_4, _mm_mul_pd(r2, r2))));
+    }
+    return _mm_mul_pd(_mm_mul_pd(x, r), _mm_mul_pd(r, r));
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128 root4_ps(__m128 x, root_method R) {
+    if (R != ROOT_NEWTON)
+        return _mm_sqrt_ps(_mm_sqrt_ps(x));
+
+    __m128 r = _mm_castsi128_ps(_mm_sub_epi32(
+        _mm_set1_epi32(ROOT_NEWTON_MAGIC_F32),
+        _mm_srli_epi32(_mm_castps_si128(x), 2)));
+    const __m128 x_4 = _mm_mul_ps(x, _mm_set1_ps(0.25f));
+    for (int n = 0; n < ROOT_NEWTON_STEPS; n++) {
+        __m128 r2 = _mm_mul_ps(r, r);
+        r = _mm_mul_ps(r, _mm_sub_ps(_mm_set1_ps(1.25f), _mm_mul_ps(x_4, _mm_mul_ps(r2, r2))));
+    }
+    return _mm_mul_ps(_mm_mul_ps(x, r), _mm_mul_ps(r, r));
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256d root4_pd(__m256d x, root_method R) {
+    if (R != ROOT_NEWTON)
+        return _mm256_sqrt_pd(_mm256_sqrt_pd(x));
+
+    __m256d r = _mm256_castsi256_pd(_mm256_sub_epi64(
+        _mm256_set1_epi64x(ROOT_NEWTON_MAGIC_F64),
+        _mm256_srli_epi64(_mm256_castpd_si256(x), 2)));
+    const __m256d x_4 = _mm256_mul_pd(x, _mm256_set1_pd(0.25));
+    for (int n = 0; n < ROOT_NEWTON_STEPS; n++) {
+        __m256d r2 = _mm256_mul_pd(r, r);
+        r = _mm256_mul_pd(r, _mm256_fnmadd_pd(x_4, _mm256_mul_pd(r2, r2), _mm256_set1_pd(1.25)));
+    }
+    return _mm256_mul_pd(_mm256_mul_pd(x, r), _mm256_mul_pd(r, r));
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 root4_ps(__m256 x, root_method R) {
+    if (R != ROOT_NEWTON)
+        return _mm256_sqrt_ps(_mm256_sqrt_ps(x));
+
+    __m256 r = _mm256_castsi256_ps(_mm256_sub_epi32(
+        _mm256_set1_epi32(ROOT_NEWTON_MAGIC_F32),
+        _mm256_srli_epi32(_mm256_castps_si256(x), 2)));
+    const __m256 x_4 = _mm256_mul_ps(x, _mm256_set1_ps(0.25f));
+    for (int n = 0; n < ROOT_NEWTON_STEPS; n++) {
+        __m256 r2 = _mm256_mul_ps(r, r);
+        r = _mm256_mul_ps(r, _mm256_fnmadd_ps(x_4, _mm256_mul_ps(r2, r2), _mm256_set1_ps(1.25f)));
+    }
+    return _mm256_mul_ps(_mm256_mul_ps(x, r), _mm256_mul_ps(r, r));
+}
+
+template<root_method R>
+__attribute__((target("sse4.1")))
+static void sse4_impl(const pixel_kernel_args & args) {
+    const __m128d kelvin = _mm_set1_pd(273.15);
+
+    for (int row = 0; row < 24; row++) {
+        const __m128d mask = _mm_castsi128_pd(_mm_set_epi64x(
+            lane_active(args, row, 1) ? -1 : 0,
+            lane_active(args, row, 0) ? -1 : 0));
+
+        for (int col = 0; col < 32; col += 2) {
+            int thispixel = row * 32 + col;
+            int32_t raw2;
+            memcpy(&raw2, &args.ram_PIX[thispixel], sizeof(raw2));
+
+            __m128d raw = _mm_cvtepi32_pd(_mm_cvtepi16_epi32(_mm_cvtsi32_si128(raw2)));
+            __m128d x = _mm_add_pd(
+                _mm_mul_pd(raw, _mm_loadu_pd(&args.scale[thispixel])),
+                _mm_loadu_pd(&args.bias[thispixel]));
+            __m128d To = _mm_sub_pd(root4_pd(x, R), kelvin);
+
+            _mm_storeu_pd(&args.To[thispixel],
+                _mm_blendv_pd(_mm_loadu_pd(&args.To[thispixel]), To, mask));
+        }
+    }
+}
+
+template<root_method R>
+__attribute__((target("sse4.1")))
+static void sse4_f32_impl(const pixel_kernel_args & args) {
+    const __m128d kelvin = _mm_set1_pd(273.15);
+
+    for (int row = 0; row < 24; row++) {
+        const __m128d mask = _mm_castsi128_pd(_mm_set_epi64x(
+            lane_active(args, row, 1) ? -1 : 0,
+            lane_active(args, row, 0) ? -1 : 0));
+
+        for (int col = 0; col < 32; col += 4) {
+            int thispixel = row * 32 + col;
+
+            __m128 raw = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(
+                _mm_loadl_epi64((const __m128i *)&args.ram_PIX[thispixel])));
+            __m128 x = _mm_add_ps(
+                _mm_mul_ps(raw, _mm_loadu_ps(&args.scale_f[thispixel])),
+                _mm_loadu_ps(&args.bias_f[thispixel]));
+            __m128 To_K = root4_ps(x, R);
+
+            __m128d To[2] = {
+                _mm_sub_pd(_mm_cvtps_pd(To_K), kelvin),
+                _mm_sub_pd(_mm_cvtps_pd(_mm_movehl_ps(To_K, To_K)), kelvin) };
+            for (int half = 0; half < 2; half++) {
+                int p = thispixel + half * 2;
+                _mm_storeu_pd(&args.To[p],
+                    _mm_blendv_pd(_mm_loadu_pd(&args.To[p]), To[half], mask));
+            }
+        }
+    }
+}
+
+template<root_method R>
+__attribute__((target("avx2,fma")))
+static void avx2_impl(const pixel_kernel_args & args) {
+    const __m256d kelvin = _mm256_set1_pd(273.15);
+
+    for (int row = 0; row < 24; row++) {
+        const long long even = lane_active(args, row, 0) ? -1 : 0;
+        const long long odd = lane_active(args, row, 1) ? -1 : 0;
+        const __m256d mask = _mm256_castsi256_pd(_mm256_setr_epi64x(even, odd, even, odd));
+
+        for (int col = 0; col < 32; col += 4) {
+            int thispixel = row * 32 + col;
+
+            __m256d raw = _mm256_cvtepi32_pd(_mm_cvtepi16_epi32(
+                _mm_loadl_epi64((const __m128i *)&args.ram_PIX[thispixel])));
+            __m256d x = _mm256_fmadd_pd(raw,
+                _mm256_loadu_pd(&args.scale[thispixel]),
+                _mm256_loadu_pd(&args.bias[thispixel]));
+            __m256d To = _mm256_sub_pd(root4_pd(x, R), kelvin);
+
+            _mm256_storeu_pd(&args.To[thispixel],
+                _mm256_blendv_pd(_mm256_loadu_pd(&args.To[thispixel]), To, mask));
+        }
+    }
+}
+
+template<root_method R>
+__attribute__((target("avx2,fma")))
+static void avx2_f32_impl(const pixel_kernel_args & args) {
+    const __m256d kelvin = _mm256_set1_pd(273.15);
+
+    for (int row = 0; row < 24; row++) {
+        const long long even = lane_active(args, row, 0) ? -1 : 0;
+        const long long odd = lane_active(args, row, 1) ? -1 : 0;
+        const __m256d mask = _mm256_castsi256_pd(_mm256_setr_epi64x(even, odd, even, odd));
+
+        for (int col = 0; col < 32; col += 8) {
+            int thispixel = row * 32 + col;
+
+            __m256 raw = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(
+                _mm_loadu_si128((const __m128i *)&args.ram_PIX[thispixel])));
+            __m256 x = _mm256_fmadd_ps(raw,
+                _mm256_loadu_ps(&args.scale_f[thispixel]),
+                _mm256_loadu_ps(&args.bias_f[thispixel]));
+            __m256 To_K = root4_ps(x, R);
+
+            __m256d To[2] = {
+                _mm256_sub_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(To_K)), kelvin),
+                _mm256_sub_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(To_K, 1)), kelvin) };
+            for (int half = 0; half < 2; half++) {
+                int p = thispixel + half * 4;
+                _mm256_storeu_pd(&args.To[p],
+                    _mm256_blendv_pd(_mm256_loadu_pd(&args.To[p]), To[half], mask));
+            }
+        }
+    }
+}
+
+void pixel_kernel_sse4(const pixel_kernel_args & args) {
+    DISPATCH_ROOT(sse4_impl, args);
+}
+
+void pixel_kernel_sse4_f32(const pixel_kernel_args & args) {
+    DISPATCH_ROOT(sse4_f32_impl, args);
+}
+
+void pixel_kernel_avx2(const pixel_kernel_args & args) {
+    DISPATCH_ROOT(avx2_impl, args);
+}
+
+void pixel_kernel_avx2_f32(const pixel_kernel_args & args) {
+    DISPATCH_ROOT(avx2_f32_impl, args);
+}
+#endif
+
+#if defined(__aarch64__)
+// Fourth roots, see fourth_root.hpp.
+
+static inline float64x2_t root4_f64(float64x2_t x, root_method R) {
+    if (R != ROOT_NEWTON)
+        return vsqrtq_f64(vsqrtq_f64(x));
+
+    float64x2_t r = vreinterpretq_f64_u64(vsubq_u64(
+        vdupq_n_u64(ROOT_NEWTON_MAGIC_F64),
+        vshrq_n_u64(vreinterpretq_u64_f64(x), 2)));
+    const float64x2_t x_4 = vmulq_n_f64(x, 0.25);
+    for (int n = 0; n < ROOT_NEWTON_STEPS; n++) {
+        float64x2_t r2 = vmulq_f64(r, r);
+        r = vmulq_f64(r, vfmsq_f64(vdupq_n_f64(1.25), x_4, vmulq_f64(r2, r2)));
+    }
+    return vmulq_f64(vmulq_f64(x, r), vmulq_f64(r, r));
+}
+
+static inline float32x4_t root4_f32(float32x4_t x, root_method R) {
+    if (R != ROOT_NEWTON)
+        return vsqrtq_f32(vsqrtq_f32(x));
+
+    float32x4_t r = vreinterpretq_f32_u32(vsubq_u32(
+        vdupq_n_u32(ROOT_NEWTON_MAGIC_F32),
+        vshrq_n_u32(vreinterpretq_u32_f32(x), 2)));
+    const float32x4_t x_4 = vmulq_n_f32(x, 0.25f);
+    for (int n = 0; n < ROOT_NEWTON_STEPS; n++) {
+        float32x4_t r2 = vmulq_f32(r, r);
+        r = vmulq_f32(r, vfmsq_f32(vdupq_n_f32(1.25f), x_4, vmulq_f32(r2, r2)));
+    }
+    return vmulq_f32(vmulq_f32(x, r), vmulq_f32(r, r));
+}
+
+template<root_method R>
+static void neon_impl(const pixel_kernel_args & args) {
+    const float64x2_t kelvin = vdupq_n_f64(273.15);
+
+    for (int row = 0; row < 24; row++) {
+        const uint64x2_t mask = {
+            lane_active(args, row, 0) ? ~0ULL : 0ULL,
+            lane_active(args, row, 1) ? ~0ULL : 0ULL };
+
+        for (int col = 0; col < 32; col += 4) {
+            int thispixel = row * 32 + col;
+            int32x4_t raw32 = vmovl_s16(vld1_s16(&args.ram_PIX[thispixel]));
+            float64x2_t raw[2] = {
+                vcvtq_f64_s64(vmovl_s32(vget_low_s32(raw32))),
+                vcvtq_f64_s64(vmovl_s32(vget_high_s32(raw32))) };
+
+            for (int half = 0; half < 2; half++) {
+                int p = thispixel + half * 2;
+                float64x2_t x = vfmaq_f64(vld1q_f64(&args.bias[p]), raw[half], vld1q_f64(&args.scale[p]));
+                float64x2_t To = vsubq_f64(root4_f64(x, R), kelvin);
+
+                vst1q_f64(&args.To[p], vbslq_f64(mask, To, vld1q_f64(&args.To[p])));
+            }
+        }
+    }
+}
+
+template<root_method R>
+static void neon_f32_impl(const pixel_kernel_args & args) {
+    const float64x2_t kelvin = vdupq_n_f64(273.15);
+
+    for (int row = 0; row < 24; row++) {
+        const uint64x2_t mask = {
+            lane_active(args, row, 0) ? ~0ULL : 0ULL,
+            lane_active(args, row, 1) ? ~0ULL : 0ULL };
+
+        for (int col = 0; col < 32; col += 4) {
+            int thispixel = row * 32 + col;
+            float32x4_t raw = vcvtq_f32_s32(vmovl_s16(vld1_s16(&args.ram_PIX[thispixel])));
+            float32x4_t x = vfmaq_f32(vld1q_f32(&args.bias_f[thispixel]),
+                raw, vld1q_f32(&args.scale_f[thispixel]));
+            float32x4_t To_K = root4_f32(x, R);
+
+            float64x2_t To[2] = {
+                vsubq_f64(vcvt_f64_f32(vget_low_f32(To_K)), kelvin),
+                vsubq_f64(vcvt_high_f64_f32(To_K), kelvin) };
+            for (int half = 0; half < 2; half++) {
+                int p = thispixel + half * 2;
+                vst1q_f64(&args.To[p], vbslq_f64(mask, To[half], vld1q_f64(&args.To[p])));
+            }
+        }
+    }
+}
+
+void pixel_kernel_neon(const pixel_kernel_args & args) {
+    DISPATCH_ROOT(neon_impl, args);
+}
+
+void pixel_kernel_neon_f32(const pixel_kernel_args & args) {
+    DISPATCH_ROOT(neon_f32_impl, args);
+}
+#endif
+
+static const pixel_kernel kernels[] = {
+    // best first
+#if defined(__x86_64__) || defined(__i386__)
+    { "avx2", pixel_kernel_avx2, false, false },
+    { "avx2", pixel_kernel_avx2_f32, true, false },
+    { "sse4", pixel_kernel_sse4, false, false },
+    { "sse4", pixel_kernel_sse4_f32, true, false },
+#endif
+#if defined(__aarch64__)
+    { "neon", pixel_kernel_neon, false, false },
+    { "neon", pixel_kernel_neon_f32, true, false },
+#endif
+    { "scalar", pixel_kernel_scalar, false, true },
+    { "scalar", pixel_kernel_scalar_f32, true, true },
+};
+
+static bool kernel_supported(const pixel_kernel & k) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (k.fn == pixel_kernel_avx2 || k.fn == pixel_kernel_avx2_f32)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if (k.fn == pixel_kernel_sse4 || k.fn == pixel_kernel_sse4_f32)
+        return __builtin_cpu_supports("sse4.1");
+#endif
+    // NEON (with float64 lanes) is mandatory on aarch64.
+    (void)k;
+    return true;
+}
+
+pixel_kernel select_pixel_kernel(const char * name, bool single_precision) {
+    bool any = (name == nullptr || strcmp(name, "auto") == 0);
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+#endif
+
+    for (const pixel_kernel & k : kernels) {
+        if (!any && strcmp(name, k.name) != 0)
+            continue;
+        if (k.single_precision != single_precision)
+            continue;
+        if (kernel_supported(k))
+            return k;
+    }
+    return { nullptr, nullptr, false, false };
+}
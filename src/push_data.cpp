@@ -1,86 +1,173 @@
 #include <gst/gst.h>
 #include <gst/video/video.h>
 #include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
 
 #include <cstdio>
+#include <cstring>
 
 #include "push_data.hpp"
+#include "notable_meta.hpp"
+#include "overlay.hpp"
+#include "trace.hpp"
 
-#define CHUNK_SIZE (32 * 24 * 2)   /* Amount of bytes we are sending in each buffer */
+/* Kept around besides the ones in flight downstream, so acquiring one
+ * does not have to wait for a sink to let go of its buffer */
+#define POOL_MIN_BUFFERS 4
 
 /* Structure to contain all our information, so we can pass it to callbacks */
 typedef struct _CustomData {
     GstElement *pipeline, *app_source, *video_scale, *caps_filter;
-    GstElement *gl_upload, *gl_colorconvert, *gl_effects_heat, *gl_overlay;
-    GstElement *app_src_txt, *text_overlay, *gl_imagesink;
+    GstElement *gl_upload, *gl_colorconvert, *gl_effects_heat;
+    GstElement *gl_overlay, *gl_imagesink;
 
+    /* Readouts and crosshair, composited onto the heat map by gl_overlay */
+    overlay_renderer *overlay;
+    GstVideoOverlayRectangle *cross_rect;
+    mlx90640::notable_pxls_t overlay_pix;
+    bool have_overlay_pix;
+
+    /* Headless: appsrc straight into this, and no text */
+    GstElement *headless_sink;
+    gst_sink_config sink;
+
+    /* What appsrc sends, and buffers for it, set up in gst_stream_start() */
+    GstVideoInfo info;
+    GstBufferPool *pool;
     GstBuffer *buffer;
     GstMapInfo map;
 
     GstControlSource * csource;
 
     bool feed_running;
+    /* Frames discarded while not feed_running */
+    unsigned long dropped;
 } CustomData;
 
+/* The stream behind the single-sensor functions */
 static CustomData * _data = NULL;
 
-uint8_t * gst_get_userp(void) {
-    if (_data == NULL) return NULL;
-
-    /* Create a new empty buffer */
-    if (_data->buffer == NULL) {
-        _data->buffer = gst_buffer_new_and_alloc (CHUNK_SIZE);
-        gst_buffer_map (_data->buffer, &(_data->map), GST_MAP_WRITE);
+struct gst_frame {
+    GstBuffer *buffer;      /* NULL: none held */
+    GstMapInfo map;
+};
+
+/* Take a free buffer from the pool, or allocate one if there is no pool,
+ * and map it for writing; NULL if there is none */
+static GstBuffer * acquire_buffer(CustomData * stream, GstMapInfo * map) {
+    GstBuffer *buffer = NULL;
+
+    TRACE_SCOPE("buffer_alloc");
+    if (stream->pool == NULL)
+        buffer = gst_buffer_new_and_alloc (GST_VIDEO_INFO_SIZE (&stream->info));
+    else if (gst_buffer_pool_acquire_buffer (stream->pool, &buffer, NULL) != GST_FLOW_OK)
+        buffer = NULL;
+    if (buffer == NULL)
+        return NULL;
+    if (!gst_buffer_map (buffer, map, GST_MAP_WRITE)) {
+        gst_buffer_unref (buffer);
+        return NULL;
     }
+    return buffer;
+}
+
+/* Unmap buffer and hand it to appsrc with the notable pixels */
+static bool push_buffer(CustomData * stream, GstBuffer * buffer, GstMapInfo * map,
+                        const mlx90640::notable_pxls_t * const pix_list) {
+    gst_buffer_unmap (buffer, map);
+
+    /* The notable pixels travel with the frame they belong to */
+    if (pix_list != NULL)
+        buffer_add_notable_meta (buffer, pix_list);
+
+    /* Push the buffer into the appsrc */
+    return gst_app_src_push_buffer((GstAppSrc *)(stream->app_source), buffer) == GST_FLOW_OK;
+}
+
+uint8_t * gst_stream_get_userp(CustomData * stream) {
+    if (stream == NULL) return NULL;
+
+    if (stream->buffer == NULL)
+        stream->buffer = acquire_buffer (stream, &(stream->map));
+    if (stream->buffer == NULL)
+        return NULL;
 
     /* Return the data portion pointer of the buffer */
-    return _data->map.data;
+    return stream->map.data;
 }
 
-bool gst_arm_buffer(const mlx90640::notable_pxls_t * const pix_list) {
-    GstFlowReturn ret;
-    GstFlowReturn ret_txt;
-    char overlay_str[64];
+bool gst_stream_arm_buffer(CustomData * stream, const mlx90640::notable_pxls_t * const pix_list) {
+    bool ok;
 
-    if (_data == NULL || _data->buffer == NULL)
+    if (stream == NULL || stream->buffer == NULL)
         return false;
 
+    // Includes gst_app_src_push_buffer() blocking on a full queue
+    TRACE_SCOPE("push_buffer");
+
     /* Set the buffer's timestamp and duration - NOT */
     // http://gstreamer-devel.966125.n4.nabble.com/How-do-you-construct-the-timestamps-duration-for-video-audio-appsrc-when-captured-by-DeckLink-tp4675678p4675748.html
     // You set do-timestamp to true.
 
     /* TODO: Ideally, we can start & stop the camera,
      * but let's just discard *ALL* the data for the time being */
-    if (!_data->feed_running)
+    if (!stream->feed_running) {
+        stream->dropped++;
         return TRUE; // eeeeeehhhh... we're *not* experiencing a problem, right?
+    }
+
+    ok = push_buffer (stream, stream->buffer, &(stream->map), pix_list);
+    stream->buffer = NULL;
+
+    /* We got some error, stop sending data */
+    return ok;
+}
 
-    gst_buffer_unmap (_data->buffer, &(_data->map));
+gst_frame * gst_frame_new(void) {
+    gst_frame * frame = new gst_frame;
+    frame->buffer = NULL;
+    return frame;
+}
 
-    /* Push the buffer into the app_src_txt */
-    GstBuffer * txtbuf;
+static void frame_release(gst_frame * frame) {
+    if (frame->buffer == NULL)
+        return;
+    gst_buffer_unmap (frame->buffer, &(frame->map));
+    gst_buffer_unref (frame->buffer);
+    frame->buffer = NULL;
+}
 
-    snprintf(overlay_str, 64, "MAX: %.2lf\nMIN: %.2lf\nMID: %.2lf",
-        (*pix_list)[mlx90640::MAX_T].T,
-        (*pix_list)[mlx90640::MIN_T].T,
-        (*pix_list)[mlx90640::SCENE_CENTER].T);
+void gst_frame_free(gst_frame * frame) {
+    if (frame == NULL) return;
+    frame_release (frame);
+    delete frame;
+}
 
-    txtbuf = gst_buffer_new_wrapped_bytes (
-        g_string_free_to_bytes (
-            g_string_new(overlay_str)
-        )
-    );
+uint8_t * gst_stream_map_frame(CustomData * stream, gst_frame * frame) {
+    if (stream == NULL || frame == NULL) return NULL;
 
-    /* Push the buffer into the appsrc */
-    ret = gst_app_src_push_buffer((GstAppSrc *)(_data->app_source), _data->buffer);
-    _data->buffer = NULL;
-    ret_txt = gst_app_src_push_buffer((GstAppSrc *)(_data->app_src_txt), txtbuf);
+    frame_release (frame);
+    frame->buffer = acquire_buffer (stream, &(frame->map));
+    return frame->buffer == NULL ? NULL : frame->map.data;
+}
+
+bool gst_stream_push_frame(CustomData * stream, gst_frame * frame,
+                           const mlx90640::notable_pxls_t * const pix_list) {
+    if (stream == NULL || frame == NULL || frame->buffer == NULL)
+        return false;
 
-    if (ret != GST_FLOW_OK || ret_txt != GST_FLOW_OK) {
-        /* We got some error, stop sending data */
-        return FALSE;
+    TRACE_SCOPE("push_buffer");
+
+    /* As gst_stream_arm_buffer(), but the buffer goes back to the pool */
+    if (!stream->feed_running) {
+        stream->dropped++;
+        frame_release (frame);
+        return true;
     }
 
-    return TRUE;
+    bool ok = push_buffer (stream, frame->buffer, &(frame->map), pix_list);
+    frame->buffer = NULL;
+    return ok;
 }
 
 /* This signal callback triggers when appsrc needs data. */
@@ -112,22 +199,243 @@ static void error_cb (GstBus * /*bus*/, GstMessage *msg, CustomData * /*data*/)
     g_free (debug_info);
 }
 
-int gst_init_(int scale_type, int scale_ratio) {
-    _data = new CustomData;
-    CustomData &data = *_data;
-    GstVideoInfo info;
+static void configure_app_source(CustomData &data) {
     GstCaps *video_caps;
-    GstCaps *text_caps;
+
+    /* Configure appsrc */
+    /* http://gstreamer-devel.966125.n4.nabble.com/How-do-you-construct-the-timestamps-duration-for-video-audio-appsrc-when-captured-by-DeckLink-tp4675678p4675748.html */
+    gst_video_info_init(&data.info);
+    gst_video_info_set_format (&data.info, GST_VIDEO_FORMAT_GRAY16_LE, 32, 24);
+    video_caps = gst_video_info_to_caps (&data.info);
+    g_object_set (data.app_source,
+                    "caps", video_caps,
+                    "format", GST_FORMAT_TIME,
+                    "stream-type", GST_APP_STREAM_TYPE_STREAM,
+                    "do-timestamp", true,
+                    //"min-latency", GST_SECOND / 4/* fps */,
+                    "is-live", true,
+                    NULL);
+    gst_caps_unref (video_caps);
+    g_signal_connect (data.app_source, "need-data", G_CALLBACK (start_feed), &data);
+    g_signal_connect (data.app_source, "enough-data", G_CALLBACK (stop_feed), &data);
+}
+
+static bool configure_pool(GstBufferPool *pool, GstCaps *caps, guint size, guint min, guint max) {
+    GstStructure *config = gst_buffer_pool_get_config (pool);
+
+    gst_buffer_pool_config_set_params (config, caps, size, min, max);
+    gst_buffer_pool_config_add_option (config, GST_BUFFER_POOL_OPTION_VIDEO_META);
+    return gst_buffer_pool_set_config (pool, config) && gst_buffer_pool_set_active (pool, TRUE);
+}
+
+/* The pool appsrc buffers come from: downstream's if it proposes one in
+ * the allocation query, else a video pool of our own for data.info.
+ * On failure frames are allocated one by one, as before. */
+static void setup_pool(CustomData &data) {
+    GstCaps *caps = gst_video_info_to_caps (&data.info);
+    GstPad *pad = gst_element_get_static_pad (data.app_source, "src");
+    GstQuery *query = gst_query_new_allocation (caps, TRUE);
+    GstBufferPool *pool = NULL;
+    guint size = GST_VIDEO_INFO_SIZE (&data.info), min = 0, max = 0;
+
+    if (gst_pad_peer_query (pad, query) && gst_query_get_n_allocation_pools (query) > 0)
+        gst_query_parse_nth_allocation_pool (query, 0, &pool, &size, &min, &max);
+    gst_query_unref (query);
+    gst_object_unref (pad);
+
+    size = MAX (size, (guint)GST_VIDEO_INFO_SIZE (&data.info));
+    min = MAX (min, (guint)POOL_MIN_BUFFERS);
+    if (pool != NULL && !configure_pool (pool, caps, size, min, max)) {
+        g_printerr ("Downstream buffer pool rejected our configuration, using our own.\n");
+        gst_object_unref (pool);
+        pool = NULL;
+    }
+    if (pool == NULL) {
+        pool = gst_video_buffer_pool_new ();
+        if (!configure_pool (pool, caps, GST_VIDEO_INFO_SIZE (&data.info), POOL_MIN_BUFFERS, 0)) {
+            g_printerr ("Buffer pool could not be set up, allocating every frame.\n");
+            gst_object_unref (pool);
+            pool = NULL;
+        }
+    }
+    gst_caps_unref (caps);
+    data.pool = pool;
+}
+
+static void watch_bus(CustomData &data) {
     GstBus *bus;
 
+    /* Instruct the bus to emit signals for each received message, and connect to the interesting signals */
+    bus = gst_element_get_bus (data.pipeline);
+    gst_bus_add_signal_watch (bus);
+    g_signal_connect (G_OBJECT (bus), "message::error", (GCallback)error_cb, &data);
+    gst_object_unref (bus);
+}
+
+/* appsink streaming thread: hand each frame to the user callback */
+static GstFlowReturn new_sample_cb (GstAppSink *sink, gpointer user_data) {
+    CustomData *data = (CustomData *)user_data;
+    GstSample *sample = gst_app_sink_pull_sample (sink);
+    GstMapInfo map;
+
+    if (sample == NULL)
+        return GST_FLOW_EOS;
+
+    GstBuffer *buffer = gst_sample_get_buffer (sample);
+    if (gst_buffer_map (buffer, &map, GST_MAP_READ)) {
+        const notable_meta *meta = buffer_get_notable_meta (buffer);
+        data->sink.callback((const uint16_t *)map.data, meta ? &meta->pix : NULL, data->sink.user);
+        gst_buffer_unmap (buffer, &map);
+    }
+    gst_sample_unref (sample);
+    return GST_FLOW_OK;
+}
+
+/* appsrc ! fakesink / filesink / appsink; nothing that needs a display */
+static CustomData * build_headless(CustomData * stream, const gst_sink_config &sink) {
+    CustomData &data = *stream;
+
+    data.sink = sink;
+    data.app_source = gst_element_factory_make ("appsrc", "mlx_source");
+    switch (sink.type) {
+    case SINK_FILE:
+        data.headless_sink = gst_element_factory_make ("filesink", "file_sink");
+        break;
+    case SINK_CALLBACK:
+        data.headless_sink = gst_element_factory_make ("appsink", "app_sink");
+        break;
+    case SINK_FAKE:
+    default:
+        data.headless_sink = gst_element_factory_make ("fakesink", "fake_sink");
+        break;
+    }
+    data.pipeline = gst_pipeline_new ("headless-pipeline");
+
+    if (!data.pipeline || !data.app_source || !data.headless_sink) {
+        g_printerr ("Not all elements could be created.\n");
+        delete stream;
+        return NULL;
+    }
+
+    configure_app_source(data);
+
+    /* Nothing to pace for: take frames as fast as they come */
+    g_object_set (data.headless_sink, "sync", false, NULL);
+    if (sink.type == SINK_FILE)
+        g_object_set (data.headless_sink, "location", sink.path, NULL);
+    if (sink.type == SINK_CALLBACK) {
+        GstAppSinkCallbacks callbacks;
+        memset (&callbacks, 0, sizeof (callbacks));
+        callbacks.new_sample = new_sample_cb;
+        gst_app_sink_set_callbacks ((GstAppSink *)data.headless_sink, &callbacks, &data, NULL);
+    }
+
+    gst_bin_add_many (GST_BIN (data.pipeline), data.app_source, data.headless_sink, NULL);
+    if (gst_element_link (data.app_source, data.headless_sink) != TRUE) {
+        g_printerr ("Elements could not be linked.\n");
+        gst_object_unref (data.pipeline);
+        delete stream;
+        return NULL;
+    }
+
+    watch_bus(data);
+
+    return stream;
+}
+
+/* appsrc src pad: keep the notable pixels of the frame about to pass.
+ * Everything up to the sink runs within this push, so overlay_probe() gets
+ * them with that very frame, even through GL elements that drop metas. */
+static GstPadProbeReturn notable_probe (GstPad * /*pad*/, GstPadProbeInfo *info, gpointer user_data) {
+    CustomData *data = (CustomData *)user_data;
+    const notable_meta *meta = buffer_get_notable_meta (GST_PAD_PROBE_INFO_BUFFER (info));
+
+    if (meta != NULL) {
+        memcpy (data->overlay_pix, meta->pix, sizeof (data->overlay_pix));
+        data->have_overlay_pix = true;
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+/* A transparent image of r for an overlay rectangle, mapped for drawing */
+static GstBuffer * overlay_buffer_new (const overlay_region &r, GstMapInfo *map) {
+    GstBuffer *buffer = gst_buffer_new_and_alloc (r.w * r.h * 4);
+    if (buffer == NULL)
+        return NULL;
+    /* BGRA on little endian hosts; the renderer only needs alpha last */
+    gst_buffer_add_video_meta (buffer, GST_VIDEO_FRAME_FLAG_NONE,
+            GST_VIDEO_OVERLAY_COMPOSITION_FORMAT_RGB, r.w, r.h);
+    if (!gst_buffer_map (buffer, map, GST_MAP_WRITE)) {
+        gst_buffer_unref (buffer);
+        return NULL;
+    }
+    memset (map->data, 0, map->size);
+    return buffer;
+}
+
+static GstVideoOverlayRectangle * overlay_rectangle_new (const overlay_region &r, GstBuffer *buffer) {
+    GstVideoOverlayRectangle *rect = gst_video_overlay_rectangle_new_raw (buffer,
+            r.x, r.y, r.w, r.h, GST_VIDEO_OVERLAY_FORMAT_FLAG_NONE);
+    gst_buffer_unref (buffer);
+    return rect;
+}
+
+/* The crosshair never changes: drawn once, and gl_overlay keeps the texture */
+static GstVideoOverlayRectangle * cross_rectangle_new (const overlay_renderer &overlay) {
+    overlay_region r = overlay.cross_region ();
+    GstMapInfo map;
+    GstBuffer *buffer = overlay_buffer_new (r, &map);
+    if (buffer == NULL)
+        return NULL;
+    overlay.draw_cross (map.data, r.w * 4);
+    gst_buffer_unmap (buffer, &map);
+    return overlay_rectangle_new (r, buffer);
+}
+
+/* gl_effects_heat src pad: attach the overlays to the heat map, still in GL
+ * memory, for gl_overlay to composite; only the readouts are drawn anew */
+static GstPadProbeReturn overlay_probe (GstPad * /*pad*/, GstPadProbeInfo *info, gpointer user_data) {
+    CustomData *data = (CustomData *)user_data;
+
+    TRACE_SCOPE("overlay");
+    GstVideoOverlayComposition *comp = gst_video_overlay_composition_new (data->cross_rect);
+    if (data->have_overlay_pix) {
+        overlay_region r = data->overlay->text_region ();
+        GstMapInfo map;
+        GstBuffer *text = overlay_buffer_new (r, &map);
+        if (text != NULL) {
+            data->overlay->draw_text (map.data, r.w * 4, data->overlay_pix);
+            gst_buffer_unmap (text, &map);
+            GstVideoOverlayRectangle *rect = overlay_rectangle_new (r, text);
+            gst_video_overlay_composition_add_rectangle (comp, rect);
+            gst_video_overlay_rectangle_unref (rect);
+        }
+    }
+
+    GstBuffer *buffer = gst_buffer_make_writable (GST_PAD_PROBE_INFO_BUFFER (info));
+    GST_PAD_PROBE_INFO_DATA (info) = buffer;
+    gst_buffer_add_video_overlay_composition_meta (buffer, comp);
+    gst_video_overlay_composition_unref (comp);
+    return GST_PAD_PROBE_OK;
+}
+
+CustomData * gst_stream_new(int scale_type, int scale_ratio, const gst_sink_config * sink) {
+    CustomData * stream = new CustomData;
+    CustomData &data = *stream;
+
     /* Initialize cumstom data structure */
     memset (&data, 0, sizeof (data));
+    data.pool = NULL;
+    data.overlay = NULL;
     data.buffer = NULL;
     data.feed_running = false;
 
     /* Initialize GStreamer */
     gst_init (NULL, NULL);
 
+    if (sink != NULL && sink->type != SINK_DISPLAY)
+        return build_headless(stream, *sink);
+
     /* Create the elements */
     data.app_source = gst_element_factory_make ("appsrc", "mlx_source");
     data.video_scale = gst_element_factory_make("videoscale", "video_scale");
@@ -136,37 +444,21 @@ int gst_init_(int scale_type, int scale_ratio) {
     data.gl_upload = gst_element_factory_make("glupload", "gl_upload");
     data.gl_colorconvert = gst_element_factory_make("glcolorconvert", "gl_colorconvert");
     data.gl_effects_heat = gst_element_factory_make("gleffects_heat", "gl_effects_heat");
-    data.gl_overlay = gst_element_factory_make("gloverlay", "gl_overlay");
-
-    data.app_src_txt = gst_element_factory_make ("appsrc", "app_src_text");
-    data.text_overlay = gst_element_factory_make("textoverlay", "text_overlay");
+    data.gl_overlay = gst_element_factory_make("gloverlaycompositor", "gl_overlay");
     data.gl_imagesink = gst_element_factory_make("glimagesink", "gl_imagesink");
 
     /* Create the empty pipeline */
     data.pipeline = gst_pipeline_new ("test-pipeline");
 
     if (!data.pipeline || !data.app_source || !data.video_scale || !data.caps_filter ||
-            !data.gl_upload || !data.gl_colorconvert || !data.gl_effects_heat || !data.gl_overlay ||
-            !data.app_src_txt || !data.text_overlay || !data.gl_imagesink) {
+            !data.gl_upload || !data.gl_colorconvert || !data.gl_effects_heat ||
+            !data.gl_overlay || !data.gl_imagesink) {
         g_printerr ("Not all elements could be created.\n");
-        return -1;
+        delete stream;
+        return NULL;
     }
 
-    /* Configure appsrc */
-    /* http://gstreamer-devel.966125.n4.nabble.com/How-do-you-construct-the-timestamps-duration-for-video-audio-appsrc-when-captured-by-DeckLink-tp4675678p4675748.html */
-    gst_video_info_init(&info);
-    gst_video_info_set_format (&info, GST_VIDEO_FORMAT_GRAY16_LE, 32, 24);
-    video_caps = gst_video_info_to_caps (&info);
-    g_object_set (data.app_source,
-                    "caps", video_caps,
-                    "format", GST_FORMAT_TIME,
-                    "stream-type", GST_APP_STREAM_TYPE_STREAM,
-                    "do-timestamp", true,
-                    //"min-latency", GST_SECOND / 4/* fps */,
-                    "is-live", true,
-                    NULL);
-    g_signal_connect (data.app_source, "need-data", G_CALLBACK (start_feed), &data);
-    g_signal_connect (data.app_source, "enough-data", G_CALLBACK (stop_feed), &data);
+    configure_app_source(data);
 
     /* Configure videoscale */
     g_object_set (data.video_scale,
@@ -184,74 +476,121 @@ int gst_init_(int scale_type, int scale_ratio) {
             "caps", caps,
             NULL);
 
-    /* Configure gloverlay */
-    //location=./18231_rgb.png overlay-width=16 overlay-height=16 relative-x=0.5 relative-y=0.5
-    g_object_set (data.gl_overlay,
-            "location", "18231_rgb.png",
-            "overlay-width", scale_ratio,
-            "overlay-height", scale_ratio,
-            "relative-x", 0.5,
-            "relative-y", 0.5,
-            NULL);
-
-    /* Configure app_src_txt */
-    text_caps = gst_caps_new_simple("text/x-raw",
-                    "format", G_TYPE_STRING, "utf8",
-                    NULL);
-    g_object_set (data.app_src_txt,
-                    "caps", text_caps,
-                    "format", GST_FORMAT_TIME,
-                    "stream-type", GST_APP_STREAM_TYPE_STREAM,
-                    "do-timestamp", true,
-                    //"min-latency", GST_SECOND / 4/* fps */,
-                    "is-live", true,
-                    NULL);
-
-    /* Configure textoverlay */
-    g_object_set (data.text_overlay,
-            "text", "test1",
-            "font-desc", "Sans, 20",
-            "valignment", 2,
-            "halignment", 2,
-            NULL);
+    data.overlay = new overlay_renderer(scale_ratio);
+    data.cross_rect = cross_rectangle_new (*data.overlay);
+    if (data.cross_rect == NULL) {
+        g_printerr ("Cannot draw the overlay.\n");
+        gst_object_unref (data.pipeline);
+        delete data.overlay;
+        delete stream;
+        return NULL;
+    }
 
     /* Link all elements because they have "Always" pads */
     gst_bin_add_many (GST_BIN (data.pipeline),
             data.app_source, data.video_scale, data.caps_filter,
-            data.gl_upload, data.gl_colorconvert, data.gl_effects_heat, data.gl_overlay,
-            data.app_src_txt, data.text_overlay, data.gl_imagesink, NULL);
+            data.gl_upload, data.gl_colorconvert, data.gl_effects_heat,
+            data.gl_overlay, data.gl_imagesink, NULL);
     if (gst_element_link_many (
             data.app_source, data.video_scale, data.caps_filter,
-            data.gl_upload, data.gl_colorconvert, data.gl_effects_heat, data.gl_overlay,
-            data.text_overlay, data.gl_imagesink, NULL) != TRUE ||
-        gst_element_link(data.app_src_txt, data.text_overlay) != TRUE
-            ) {
+            data.gl_upload, data.gl_colorconvert, data.gl_effects_heat,
+            data.gl_overlay, data.gl_imagesink, NULL) != TRUE) {
         g_printerr ("Elements could not be linked.\n");
         gst_object_unref (data.pipeline);
-        return -1;
+        gst_video_overlay_rectangle_unref (data.cross_rect);
+        delete data.overlay;
+        delete stream;
+        return NULL;
     }
 
-    /* Instruct the bus to emit signals for each received message, and connect to the interesting signals */
-    bus = gst_element_get_bus (data.pipeline);
-    gst_bus_add_signal_watch (bus);
-    g_signal_connect (G_OBJECT (bus), "message::error", (GCallback)error_cb, &data);
-    gst_object_unref (bus);
+    GstPad *src_pad = gst_element_get_static_pad (data.app_source, "src");
+    gst_pad_add_probe (src_pad, GST_PAD_PROBE_TYPE_BUFFER, notable_probe, &data, NULL);
+    gst_object_unref (src_pad);
+    GstPad *overlay_pad = gst_element_get_static_pad (data.gl_effects_heat, "src");
+    gst_pad_add_probe (overlay_pad, GST_PAD_PROBE_TYPE_BUFFER, overlay_probe, &data, NULL);
+    gst_object_unref (overlay_pad);
 
-    return 0;
+    watch_bus(data);
+
+    return stream;
 }
 
-void gst_start_running(void) {
-    if (_data == NULL) return;
-    CustomData &data = *_data;
+void gst_stream_start(CustomData * stream) {
+    if (stream == NULL) return;
+    CustomData &data = *stream;
     /* Start playing the pipeline */
     gst_element_set_state (data.pipeline, GST_STATE_PLAYING);
+    setup_pool(data);
 }
 
-void gst_cleanup(void) {
-    if (_data == NULL) return;
-    CustomData &data = *_data;
+unsigned long gst_stream_dropped(CustomData * stream) {
+    return stream == NULL ? 0 : stream->dropped;
+}
+
+void gst_stream_free(CustomData * stream) {
+    if (stream == NULL) return;
+    CustomData &data = *stream;
     /* Free resources */
+    if (data.buffer != NULL) {
+        gst_buffer_unmap (data.buffer, &(data.map));
+        gst_buffer_unref (data.buffer);
+    }
     gst_element_set_state (data.pipeline, GST_STATE_NULL);
+    if (data.pool != NULL) {
+        gst_buffer_pool_set_active (data.pool, FALSE);
+        gst_object_unref (data.pool);
+    }
     gst_object_unref (data.pipeline);
-    delete(_data);
+    if (data.cross_rect != NULL)
+        gst_video_overlay_rectangle_unref (data.cross_rect);
+    delete data.overlay;
+    delete(stream);
+}
+
+uint8_t * gst_get_userp(void) {
+    return gst_stream_get_userp(_data);
+}
+
+bool gst_arm_buffer(const mlx90640::notable_pxls_t * const pix_list) {
+    return gst_stream_arm_buffer(_data, pix_list);
+}
+
+unsigned long gst_dropped(void) {
+    return gst_stream_dropped(_data);
+}
+
+uint8_t * gst_map_frame(gst_frame * frame) {
+    return gst_stream_map_frame(_data, frame);
+}
+
+bool gst_push_frame(gst_frame * frame, const mlx90640::notable_pxls_t * const pix_list) {
+    return gst_stream_push_frame(_data, frame, pix_list);
+}
+
+int gst_init_(int scale_type, int scale_ratio, const gst_sink_config * sink) {
+    _data = gst_stream_new(scale_type, scale_ratio, sink);
+    return _data == NULL ? -1 : 0;
+}
+
+void gst_start_running(void) {
+    gst_stream_start(_data);
+}
+
+void gst_cleanup(void) {
+    gst_stream_free(_data);
+    _data = NULL;
+}
+
+bool parse_sink(const char * spec, gst_sink_config * sink) {
+    memset (sink, 0, sizeof (*sink));
+    if (strcmp (spec, "display") == 0)
+        sink->type = SINK_DISPLAY;
+    else if (strcmp (spec, "fake") == 0)
+        sink->type = SINK_FAKE;
+    else if (strncmp (spec, "file:", 5) == 0 && spec[5] != '\0') {
+        sink->type = SINK_FILE;
+        sink->path = spec + 5;
+    } else
+        return false;
+    return true;
 }
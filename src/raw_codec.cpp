@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <endian.h>
+
+#include "raw_codec.hpp"
+
+// Quotients from here on are sent as RICE_ESCAPE ones and the bare 16 bits
+#define RICE_ESCAPE 20
+
+static inline uint16_t zigzag(uint16_t d) {
+    return (uint16_t)((d << 1) ^ ((d & 0x8000) ? 0xffff : 0));
+}
+
+static inline uint16_t unzigzag(uint16_t z) {
+    return (uint16_t)((z >> 1) ^ -(z & 1));
+}
+
+// Smallest k with 2^(k+1) > the block's mean, the usual Rice estimate
+static unsigned rice_k(uint32_t sum, size_t n) {
+    unsigned k = 0;
+    while (k < 15 && ((uint32_t)n << (k + 1)) <= sum)
+        k++;
+    return k;
+}
+
+// LSB first, flushed 32 bits at a time
+class bit_writer {
+public:
+    explicit bit_writer(uint8_t * out_) : out(out_), begin(out_), acc(0), bits(0) {}
+
+    // n <= 32
+    void put(uint32_t v, unsigned n) {
+        acc |= (uint64_t)v << bits;
+        bits += n;
+        if (bits >= 32) {
+            uint32_t w = htole32((uint32_t)acc);
+            memcpy(out, &w, 4);
+            out += 4;
+            acc >>= 32;
+            bits -= 32;
+        }
+    }
+
+    void put_rice(uint16_t v, unsigned k) {
+        uint32_t q = v >> k;
+        if (q < RICE_ESCAPE) {
+            put((1u << q) - 1, q + 1);
+            if (k)
+                put(v & ((1u << k) - 1), k);
+        } else {
+            put((1u << RICE_ESCAPE) - 1, RICE_ESCAPE);
+            put(v, 16);
+        }
+    }
+
+    // Bytes written, the last one padded with zeros
+    size_t finish(void) {
+        while (bits > 0) {
+            *out++ = (uint8_t)acc;
+            acc >>= 8;
+            bits = bits > 8 ? bits - 8 : 0;
+        }
+        return out - begin;
+    }
+
+private:
+    uint8_t * out;
+    uint8_t * begin;
+    uint64_t acc;
+    unsigned bits;
+};
+
+// Reads zeros past the end; overrun() tells whether it got there
+class bit_reader {
+public:
+    bit_reader(const uint8_t * data_, size_t length_)
+        : data(data_), length(length_), next(0), acc(0), bits(0) {}
+
+    uint32_t get(unsigned n) {
+        if (bits < n)
+            refill();
+        uint32_t v = (uint32_t)(acc & ((1ull << n) - 1));
+        acc >>= n;
+        bits -= n;
+        return v;
+    }
+
+    uint16_t get_rice(unsigned k) {
+        if (bits < RICE_ESCAPE + 1)
+            refill();
+        unsigned ones = __builtin_ctzll(~acc);
+        if (ones >= RICE_ESCAPE) {
+            acc >>= RICE_ESCAPE;
+            bits -= RICE_ESCAPE;
+            return (uint16_t)get(16);
+        }
+        acc >>= ones + 1;
+        bits -= ones + 1;
+        uint32_t v = ones << k;
+        if (k)
+            v |= get(k);
+        return (uint16_t)v;
+    }
+
+    bool overrun(void) const {
+        return next * 8 - bits > length * 8;
+    }
+
+private:
+    const uint8_t * data;
+    size_t length;
+    size_t next;        // byte index of the next refill
+    uint64_t acc;
+    unsigned bits;
+
+    void refill(void) {
+        while (bits <= 56) {
+            acc |= (uint64_t)(next < length ? data[next] : 0) << bits;
+            next++;
+            bits += 8;
+        }
+    }
+};
+
+raw_encoder::raw_encoder(size_t words_, unsigned keyframe_interval_)
+    : words(words_), keyframe_interval(keyframe_interval_ ? keyframe_interval_ : 1), frames(0),
+      prev(words_, 0), residual(words_, 0) {}
+
+void raw_encoder::header(uint8_t * dest) const {
+    rawz_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, RAWZ_MAGIC, sizeof(h.magic));
+    h.words = htole16((uint16_t)words);
+    h.keyframe_interval = htole16((uint16_t)keyframe_interval);
+    memcpy(dest, &h, sizeof(h));
+}
+
+size_t raw_encoder::max_record_bytes(void) const {
+    size_t blocks = (words + RAWZ_BLOCK - 1) / RAWZ_BLOCK;
+    // Every word escaped, a k per block, and the 32-bit flush slack
+    return RAWZ_RECORD_HEADER + (words * (RICE_ESCAPE + 16) + blocks * 4) / 8 + 8;
+}
+
+size_t raw_encoder::encode(const uint16_t * frame, uint8_t * dest) {
+    bool key = frames % keyframe_interval == 0;
+
+    for (size_t i = 0; i < words; i++) {
+        uint16_t cur = le16toh(frame[i]);
+        uint16_t pred = key ? (i ? le16toh(frame[i - 1]) : 0) : prev[i];
+        residual[i] = zigzag((uint16_t)(cur - pred));
+        prev[i] = cur;
+    }
+
+    bit_writer w(dest + RAWZ_RECORD_HEADER);
+    for (size_t start = 0; start < words; start += RAWZ_BLOCK) {
+        size_t n = std::min((size_t)RAWZ_BLOCK, words - start);
+        uint32_t sum = 0;
+        for (size_t i = 0; i < n; i++)
+            sum += residual[start + i];
+
+        unsigned k = rice_k(sum, n);
+        w.put(k, 4);
+        for (size_t i = 0; i < n; i++)
+            w.put_rice(residual[start + i], k);
+    }
+    uint32_t payload = (uint32_t)w.finish();
+
+    uint32_t h = htole32(payload | (key ? RAWZ_KEYFRAME : 0));
+    memcpy(dest, &h, RAWZ_RECORD_HEADER);
+    frames++;
+    return RAWZ_RECORD_HEADER + payload;
+}
+
+raw_decoder::raw_decoder()
+    : data(nullptr), length(0), pos(0), n_words(0), have_prev(false) {}
+
+bool raw_decoder::probe(const void * data, size_t length) {
+    return length >= sizeof(rawz_header) && memcmp(data, RAWZ_MAGIC, 8) == 0;
+}
+
+bool raw_decoder::open(const void * data_, size_t length_) {
+    rawz_header h;
+
+    if (!probe(data_, length_))
+        return false;
+    memcpy(&h, data_, sizeof(h));
+    n_words = le16toh(h.words);
+    if (n_words != 0x340 && n_words != 0x360) {
+        fprintf(stderr, "Compressed recording: unexpected %zu words per frame\n", n_words);
+        return false;
+    }
+
+    data = (const uint8_t *)data_;
+    length = length_;
+    pos = sizeof(rawz_header);
+    have_prev = false;
+    prev.assign(n_words, 0);
+    return true;
+}
+
+bool raw_decoder::decode(uint16_t * dest) {
+    uint32_t h;
+
+    if (length - pos < RAWZ_RECORD_HEADER) {
+        if (pos != length)
+            fprintf(stderr, "A frame did not reach its full size.\n");
+        return false;
+    }
+    memcpy(&h, data + pos, RAWZ_RECORD_HEADER);
+    h = le32toh(h);
+
+    bool key = h & RAWZ_KEYFRAME;
+    size_t payload = h & ~RAWZ_KEYFRAME;
+    if (payload > length - pos - RAWZ_RECORD_HEADER) {
+        fprintf(stderr, "A frame did not reach its full size.\n");
+        return false;
+    }
+    if (!key && !have_prev) {
+        fprintf(stderr, "Compressed recording: no keyframe to start from\n");
+        return false;
+    }
+
+    bit_reader r(data + pos + RAWZ_RECORD_HEADER, payload);
+    for (size_t start = 0; start < n_words; start += RAWZ_BLOCK) {
+        size_t n = std::min((size_t)RAWZ_BLOCK, n_words - start);
+        unsigned k = r.get(4);
+
+        for (size_t i = start; i < start + n; i++) {
+            uint16_t pred = key ? (i ? prev[i - 1] : 0) : prev[i];
+            prev[i] = (uint16_t)(pred + unzigzag(r.get_rice(k)));
+            dest[i] = htole16(prev[i]);
+        }
+    }
+    if (r.overrun()) {
+        fprintf(stderr, "Compressed recording: damaged frame at byte %zu\n", pos);
+        return false;
+    }
+
+    pos += RAWZ_RECORD_HEADER + payload;
+    have_prev = true;
+    return true;
+}
@@ -0,0 +1,240 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <errno.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "recorder.hpp"
+#include "trace.hpp"
+
+static int open_output(const char * path) {
+    if (path == nullptr)
+        return -1;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+        fprintf(stderr, "Cannot open '%s': %d, %s\n", path, errno, strerror(errno));
+    return fd;
+}
+
+// pwritev() until everything is written; iov is used up in the process
+static bool pwritev_all(int fd, struct iovec * iov, int count, off_t offset) {
+    while (count > 0) {
+        ssize_t n = pwritev(fd, iov, count, offset);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        offset += n;
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+recorder::recorder() : ring(nullptr), drop(false), frames(0), overflows(0), errors(0) {
+    for (output * out : { &gray_out, &raw_out, &rec_out }) {
+        out->fd = -1;
+        out->path = nullptr;
+        out->encoder = nullptr;
+    }
+}
+
+recorder::~recorder() {
+    stop();
+}
+
+void recorder::close_outputs(void) {
+    for (output * out : { &gray_out, &raw_out, &rec_out }) {
+        if (out->fd != -1)
+            close(out->fd);
+        out->fd = -1;
+        delete out->encoder;
+        out->encoder = nullptr;
+    }
+}
+
+// Whatever goes ahead of the frames: the rawz and container headers
+bool recorder::write_prefix(output & out, const void * data, size_t bytes) {
+    struct iovec iov = { (void *)data, bytes };
+
+    if (!pwritev_all(out.fd, &iov, 1, out.offset)) {
+        fprintf(stderr, "Cannot write '%s': %d, %s\n", out.path, errno, strerror(errno));
+        return false;
+    }
+    out.offset += bytes;
+    return true;
+}
+
+bool recorder::start(const recorder_config & config) {
+    size_t raw_bytes = config.raw_words * sizeof(uint16_t);
+
+    gray_out = { open_output(config.gray_path), 0, offsetof(slot, gray), sizeof(slot::gray),
+                 config.gray_path, nullptr };
+    raw_out = { open_output(config.raw_path), 0, offsetof(slot, raw), raw_bytes,
+                config.raw_path, nullptr };
+    rec_out = { open_output(config.record_path), 0, offsetof(slot, raw), raw_bytes,
+                config.record_path, nullptr };
+    for (output * out : { &gray_out, &raw_out, &rec_out })
+        if (out->path != nullptr && out->fd == -1) {
+            close_outputs();
+            return false;
+        }
+
+    if (config.compress_raw && raw_out.fd != -1) {
+        uint8_t header[sizeof(rawz_header)];
+
+        raw_out.encoder = new raw_encoder(config.raw_words);
+        raw_out.encoder->header(header);
+        if (!write_prefix(raw_out, header, sizeof(header))) {
+            close_outputs();
+            return false;
+        }
+        packed.resize(RECORDER_BATCH * raw_out.encoder->max_record_bytes());
+    }
+
+    if (rec_out.fd != -1) {
+        rec_header h;
+
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, REC_MAGIC, sizeof(h.magic));
+        h.words = htole16((uint16_t)config.raw_words);
+        h.ee_words = htole16(0x340);
+        h.fps = (int32_t)htole32((uint32_t)config.fps);
+        h.created_ns = (int64_t)htole64((uint64_t)recording_now());
+        if (!write_prefix(rec_out, &h, sizeof(h))
+                || !write_prefix(rec_out, config.ee, 0x340 * sizeof(uint16_t))) {
+            close_outputs();
+            return false;
+        }
+        index.clear();
+    }
+
+    drop = config.drop;
+    ring = new spsc_ring<slot, RECORDER_SLOTS>;
+    writer = std::thread(&recorder::write_loop, this);
+    return true;
+}
+
+bool recorder::record(const uint16_t * gray16, const uint16_t * raw, int64_t timestamp_ns) {
+    if (ring == nullptr)
+        return false;
+
+    slot * s = drop ? ring->claim() : ring->claim_wait();
+    if (s == nullptr) {
+        overflows.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    // Not fd: the writer closes that on errors
+    if (gray_out.path != nullptr)
+        memcpy(s->gray, gray16, gray_out.frame_bytes);
+    if (raw_out.path != nullptr || rec_out.path != nullptr)
+        memcpy(s->raw, raw, raw_out.frame_bytes);
+    s->timestamp = timestamp_ns;
+    ring->publish();
+    frames.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void recorder::write_batch(output & out, size_t n) {
+    struct iovec iov[RECORDER_BATCH];
+
+    if (out.fd == -1)
+        return;
+
+    int count = n;
+    size_t bytes = n * out.frame_bytes;
+    if (out.encoder != nullptr) {
+        TRACE_SCOPE("encode_raw");
+        bytes = 0;
+        for (size_t i = 0; i < n; i++)
+            bytes += out.encoder->encode(
+                (const uint16_t *)((uint8_t *)ring->peek_at(i) + out.slot_offset), &packed[bytes]);
+        iov[0].iov_base = packed.data();
+        iov[0].iov_len = bytes;
+        count = 1;
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            iov[i].iov_base = (uint8_t *)ring->peek_at(i) + out.slot_offset;
+            iov[i].iov_len = out.frame_bytes;
+        }
+    }
+    if (!pwritev_all(out.fd, iov, count, out.offset)) {
+        // Keep draining the queue, just stop writing this file
+        fprintf(stderr, "Cannot write '%s': %d, %s\n", out.path, errno, strerror(errno));
+        errors.fetch_add(1, std::memory_order_relaxed);
+        close(out.fd);
+        out.fd = -1;
+        return;
+    }
+
+    if (&out == &rec_out)
+        for (size_t i = 0; i < n; i++)
+            index.push_back({ htole64((uint64_t)(out.offset + i * out.frame_bytes)),
+                              (int64_t)htole64((uint64_t)ring->peek_at(i)->timestamp) });
+    out.offset += bytes;
+}
+
+void recorder::write_loop(void) {
+    TRACE_THREAD_NAME("recorder");
+
+    while (ring->peek_wait() != nullptr) {
+        TRACE_SCOPE("record");
+        size_t n = std::min(ring->ready(), (size_t)RECORDER_BATCH);
+        write_batch(gray_out, n);
+        write_batch(raw_out, n);
+        write_batch(rec_out, n);
+        ring->consume(n);
+    }
+}
+
+// The container's index and footer, after the last frame
+void recorder::write_index(void) {
+    rec_footer f;
+
+    memset(&f, 0, sizeof(f));
+    memcpy(f.magic, REC_INDEX_MAGIC, sizeof(f.magic));
+    f.frames = htole64(index.size());
+    f.index_offset = htole64((uint64_t)rec_out.offset);
+
+    struct iovec iov[2] = {
+        { index.data(), index.size() * sizeof(rec_index_entry) },
+        { &f, sizeof(f) },
+    };
+    if (!pwritev_all(rec_out.fd, iov, 2, rec_out.offset)) {
+        fprintf(stderr, "Cannot write '%s': %d, %s\n", rec_out.path, errno, strerror(errno));
+        errors.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+recorder_stats recorder::stop(void) {
+    if (ring != nullptr) {
+        // The writer drains what is left before peek_wait() gives up
+        ring->close();
+        writer.join();
+        delete ring;
+        ring = nullptr;
+
+        if (rec_out.fd != -1)
+            write_index();
+        close_outputs();
+    }
+
+    recorder_stats stats;
+    stats.frames = frames;
+    stats.overflows = overflows;
+    stats.errors = errors;
+    return stats;
+}
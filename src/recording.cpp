@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <errno.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "recording.hpp"
+
+int64_t recording_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+bool recording_probe(const char * path) {
+    char magic[8];
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    bool is_rec = pread(fd, magic, sizeof(magic), 0) == (ssize_t)sizeof(magic)
+        && memcmp(magic, REC_MAGIC, sizeof(magic)) == 0;
+    close(fd);
+    return is_rec;
+}
+
+recording::recording()
+    : fd(-1), map(nullptr), length(0), n_words(0), rec_fps(-1), created_ns(0),
+      n_frames(0), index(nullptr) {}
+
+recording::~recording() {
+    if (map != nullptr)
+        munmap((void *)map, length);
+    if (fd != -1)
+        close(fd);
+}
+
+bool recording::open(const char * path) {
+    struct stat st;
+    rec_header h;
+
+    fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        fprintf(stderr, "Cannot open '%s': %d, %s\n", path, errno, strerror(errno));
+        return false;
+    }
+    length = st.st_size;
+    if (length < REC_DATA_OFFSET || pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h)
+            || memcmp(h.magic, REC_MAGIC, sizeof(h.magic)) != 0) {
+        fprintf(stderr, "'%s' is not a recording\n", path);
+        return false;
+    }
+    n_words = le16toh(h.words);
+    if ((n_words != 0x340 && n_words != 0x360) || le16toh(h.ee_words) != 0x340) {
+        fprintf(stderr, "'%s': unsupported recording layout\n", path);
+        return false;
+    }
+    rec_fps = (int32_t)le32toh(h.fps);
+    created_ns = (int64_t)le64toh(h.created_ns);
+
+    void * p = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "Cannot map '%s': %d, %s\n", path, errno, strerror(errno));
+        return false;
+    }
+    map = (const uint8_t *)p;
+
+    // The index, if recording stopped cleanly. It has to describe the frames
+    // as they are laid out, or it is ignored.
+    size_t frame_bytes = n_words * 2;
+    if (length >= REC_DATA_OFFSET + sizeof(rec_footer)) {
+        rec_footer f;
+        memcpy(&f, map + length - sizeof(f), sizeof(f));
+        uint64_t frames = le64toh(f.frames);
+        uint64_t index_offset = le64toh(f.index_offset);
+
+        if (memcmp(f.magic, REC_INDEX_MAGIC, sizeof(f.magic)) == 0
+                && index_offset == REC_DATA_OFFSET + frames * frame_bytes
+                && index_offset + frames * sizeof(rec_index_entry) + sizeof(f) == length) {
+            n_frames = frames;
+            index = (const rec_index_entry *)(map + index_offset);
+            madvise((void *)index, frames * sizeof(rec_index_entry), MADV_WILLNEED);
+            return true;
+        }
+    }
+
+    n_frames = (length - REC_DATA_OFFSET) / frame_bytes;
+    fprintf(stderr, "Warning: '%s' has no index, was recording interrupted? "
+                    "%lu frames, without timestamps\n", path, n_frames);
+    return true;
+}
+
+int64_t recording::timestamp(unsigned long n) const {
+    if (index == nullptr || n >= n_frames)
+        return 0;
+    return (int64_t)le64toh(index[n].timestamp_ns);
+}
+
+unsigned long recording::seek_time(int64_t t) const {
+    if (index == nullptr) {
+        if (rec_fps <= 0 || t <= created_ns)
+            return 0;
+        unsigned long n = (t - created_ns) / (1000000000 / rec_fps);
+        return n < n_frames ? n : n_frames;
+    }
+
+    if (n_frames == 0 || t <= timestamp(0))
+        return 0;
+    int64_t first = timestamp(0), last = timestamp(n_frames - 1);
+    if (t > last)
+        return n_frames;
+
+    // Guess from the mean frame period: at a steady frame rate that is the
+    // frame itself or one next to it
+    unsigned long n = (unsigned long)((double)(t - first) * (n_frames - 1) / (last - first));
+    if (n >= n_frames)
+        n = n_frames - 1;
+
+    // Gallop away from the guess until [lo, hi) brackets the frame, so a
+    // guess d frames off costs O(log d), then binary search the bracket
+    unsigned long lo, hi, step = 1;
+    if (timestamp(n) < t) {
+        lo = n + 1;
+        hi = n_frames;
+        while (lo < n_frames) {
+            unsigned long probe = std::min(lo + step - 1, n_frames - 1);
+            if (timestamp(probe) >= t) {
+                hi = probe;
+                break;
+            }
+            lo = probe + 1;
+            step *= 2;
+        }
+    } else {
+        lo = 0;
+        hi = n;
+        while (hi > 0) {
+            unsigned long probe = hi >= step ? hi - step : 0;
+            if (timestamp(probe) < t) {
+                lo = probe + 1;
+                break;
+            }
+            hi = probe;
+            step *= 2;
+        }
+    }
+
+    while (lo < hi) {
+        unsigned long mid = lo + (hi - lo) / 2;
+        if (timestamp(mid) < t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+bool recording::read_frames(unsigned long first, unsigned long count, void * dest) const {
+    if (first > n_frames || count > n_frames - first)
+        return false;
+
+    size_t frame_bytes = n_words * 2;
+    size_t total = count * frame_bytes;
+    off_t offset = REC_DATA_OFFSET + (off_t)first * frame_bytes;
+    size_t done = 0;
+    while (done < total) {
+        ssize_t r = pread(fd, (uint8_t *)dest + done, total - done, offset + done);
+        if (r == -1 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        done += r;
+    }
+    return true;
+}
@@ -0,0 +1,155 @@
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+
+#include <errno.h>
+#include <endian.h>
+
+#include "synthetic.hpp"
+
+// xorshift32: small and the same everywhere, unlike std::rand()
+static uint32_t next(uint32_t & state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static int uniform(uint32_t & state, int lo, int hi) {
+    return lo + (int)(next(state) % (uint32_t)(hi - lo + 1));
+}
+
+double synthetic_sensor::gauss(uint32_t & state) const {
+    // Box-Muller, one value per call is plenty here
+    double u1 = (next(state) + 1.0) / 4294967297.0;
+    double u2 = next(state) / 4294967296.0;
+    return std::sqrt(-2 * std::log(u1)) * std::cos(2 * M_PI * u2);
+}
+
+static uint16_t pack_nibbles(const int * v) {
+    uint16_t w = 0;
+    for (int k = 0; k < 4; k++)
+        w |= (v[k] & 0xf) << (4 * k);
+    return w;
+}
+
+synthetic_sensor::synthetic_sensor(uint32_t seed_) : seed(seed_ ? seed_ : 1) {
+    uint16_t w[0x340];
+    uint32_t state = seed;
+    memset(w, 0, sizeof(w));
+
+    // Device ID and register configuration, see the check in init_ee()
+    w[0x07] = 0x1728; w[0x08] = 0x8e4f; w[0x09] = 0x0187;
+    w[0x0C] = 0x1901; w[0x0F] = 0xbe33;
+
+    // Offsets: scale_Occ_row 2, scale_Occ_col 1, scale_Occ_rem 0
+    const int row_s = 2, col_s = 1, rem_s = 0;
+    const int PIX_OS_AVG = -69;
+    int occ_row[24], occ_col[32];
+    w[0x10] = (4 << 12) | (row_s << 8) | (col_s << 4) | rem_s;
+    w[0x11] = (uint16_t)PIX_OS_AVG;
+    for (int &v : occ_row)
+        v = uniform(state, -3, 3);
+    for (int &v : occ_col)
+        v = uniform(state, -3, 3);
+    for (int i = 0; i < 6; i++)
+        w[0x12 + i] = pack_nibbles(&occ_row[4 * i]);
+    for (int i = 0; i < 8; i++)
+        w[0x18 + i] = pack_nibbles(&occ_col[4 * i]);
+
+    // Sensitivities around PIX_SENS_AVG 12100 * 2^-37
+    int acc_row[24], acc_col[32];
+    w[0x20] = (7 << 12) | (9 << 8) | (0xA << 4) | 6;
+    w[0x21] = 12100;
+    for (int &v : acc_row)
+        v = uniform(state, -2, 2);
+    for (int &v : acc_col)
+        v = uniform(state, -2, 2);
+    for (int i = 0; i < 6; i++)
+        w[0x22 + i] = pack_nibbles(&acc_row[4 * i]);
+    for (int i = 0; i < 8; i++)
+        w[0x28 + i] = pack_nibbles(&acc_col[4 * i]);
+
+    // GAIN, PTAT_25, K_V/K_T_PTAT, Vdd, K_V, K_Ta and their scales
+    w[0x30] = 6383;
+    w[0x31] = 12273;
+    w[0x32] = (22 << 10) | 337;
+    w[0x33] = 0x9d68;
+    w[0x34] = 0x5454;
+    w[0x36] = 0x5354;
+    w[0x37] = 0x5152;
+    w[0x38] = 0x2360;
+    w[0x3C] = 0xf000;
+
+    for (int row = 0; row < 24; row++) {
+        for (int col = 0; col < 32; col++) {
+            int K_Ta = uniform(state, -2, 2);
+            int a = uniform(state, -8, 8);
+            int o = uniform(state, -8, 8);
+
+            w[0x40 + row * 32 + col] = ((K_Ta & 7) << 1) | ((a & 0x3f) << 4) | ((o & 0x3f) << 10);
+            offset[row * 32 + col] = PIX_OS_AVG
+                + occ_row[row] * (1 << row_s) + occ_col[col] * (1 << col_s) + o * (1 << rem_s);
+        }
+    }
+
+    for (int i = 0; i < 0x340; i++)
+        ee.word_[i] = htole16(w[i]);
+}
+
+void synthetic_sensor::frame(unsigned long n, bool extended, uint16_t * dest) const {
+    const double a_avg = 12100 / std::ldexp(1.0, 37);
+    const double Ta = 273.15 + 38;
+    const double Ta4 = Ta * Ta * Ta * Ta;
+
+    uint16_t w[0x360];
+    uint32_t state = seed ^ (uint32_t)((n + 1) * 0x9e3779b9u);
+    memset(w, 0, sizeof(w));
+
+    int hot_x = 8 + n % 16;
+    int hot_y = 6 + (n / 3) % 12;
+    for (int row = 0; row < 24; row++) {
+        for (int col = 0; col < 32; col++) {
+            int d2 = (col - hot_x) * (col - hot_x) + (row - hot_y) * (row - hot_y);
+            double T = 273.15 + 25 + 40 * std::exp(-d2 / 8.0) + 0.3 * gauss(state);
+            double pix = a_avg * (T * T * T * T - Ta4);
+            w[row * 32 + col] = (uint16_t)(int)std::lround(pix + offset[row * 32 + col]);
+        }
+    }
+    w[0x300] = 19500;                   // V_BE
+    w[0x30a] = 6300;                    // GAIN
+    w[0x320] = 1711;                    // Ta_PTAT
+    w[0x32a] = (uint16_t)-13056;        // VDD
+    if (extended)
+        w[0x340] = n % 2;               // subpage, register 0x8000
+
+    for (int i = 0; i < (extended ? 0x360 : 0x340); i++)
+        dest[i] = htole16(w[i]);
+}
+
+bool synthetic_sensor::write_ee(const char * path) const {
+    FILE * f = fopen(path, "wb");
+    if (f == NULL)
+        return false;
+    bool ok = fwrite(ee.word_, sizeof(ee.word_), 1, f) == 1;
+    if (fclose(f) != 0)
+        ok = false;
+    return ok;
+}
+
+bool synthetic_sensor::write_recording(const char * path, unsigned long n, bool extended) const {
+    FILE * f = fopen(path, "wb");
+    if (f == NULL)
+        return false;
+
+    uint16_t w[0x360];
+    size_t words = extended ? 0x360 : 0x340;
+    bool ok = true;
+    for (unsigned long i = 0; i < n && ok; i++) {
+        frame(i, extended, w);
+        ok = fwrite(w, sizeof(uint16_t), words, f) == words;
+    }
+    if (fclose(f) != 0)
+        ok = false;
+    return ok;
+}
@@ -0,0 +1,158 @@
+#include "trace.hpp"
+
+#ifdef MLX_TRACE
+
+#include <atomic>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define TRACE_DEFAULT_PATH "mlx90640_trace.json"
+
+struct trace_event {
+    const char * name;
+    uint64_t begin;
+    uint64_t end;
+};
+
+// Written by its thread only. head counts every event ever recorded; the
+// dump reads it before and after copying the ring, and drops what may have
+// been overwritten in between, so no lock is taken on the hot path.
+struct trace_ring {
+    pid_t tid;
+    std::atomic<const char *> thread_name;
+    std::atomic<uint64_t> head;
+    trace_event events[TRACE_RING_EVENTS];
+};
+
+// Rings are never freed: a thread's events are still wanted after it ends
+static std::mutex rings_lock;
+static std::vector<trace_ring *> rings;
+static thread_local trace_ring * this_thread_ring = nullptr;
+
+static std::mutex dump_lock;
+static volatile sig_atomic_t dump_requested = 0;
+
+static trace_ring * get_ring(void) {
+    if (this_thread_ring == nullptr) {
+        trace_ring * r = new trace_ring;
+        r->tid = syscall(SYS_gettid);
+        r->thread_name = nullptr;
+        r->head = 0;
+
+        std::lock_guard<std::mutex> guard(rings_lock);
+        rings.push_back(r);
+        this_thread_ring = r;
+    }
+    return this_thread_ring;
+}
+
+void trace_record(const char * name, uint64_t begin_ns, uint64_t end_ns) {
+    trace_ring * r = get_ring();
+    uint64_t head = r->head.load(std::memory_order_relaxed);
+
+    r->events[head & (TRACE_RING_EVENTS - 1)] = { name, begin_ns, end_ns };
+    r->head.store(head + 1, std::memory_order_release);
+}
+
+void trace_thread_name(const char * name) {
+    get_ring()->thread_name = name;
+}
+
+static const char * trace_path(void) {
+    const char * path = getenv("MLX90640_TRACE");
+    return path != NULL && path[0] != '\0' ? path : TRACE_DEFAULT_PATH;
+}
+
+bool trace_dump(const char * path) {
+    std::lock_guard<std::mutex> dump_guard(dump_lock);
+    std::vector<trace_ring *> snapshot;
+    {
+        std::lock_guard<std::mutex> guard(rings_lock);
+        snapshot = rings;
+    }
+
+    FILE * f = fopen(path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Cannot open '%s': %d, %s\n", path, errno, strerror(errno));
+        return false;
+    }
+
+    pid_t pid = getpid();
+    std::vector<trace_event> events;
+    bool first = true;
+
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (trace_ring * r : snapshot) {
+        const char * thread_name = r->thread_name;
+        if (thread_name != nullptr) {
+            fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                       "\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", pid, r->tid, thread_name);
+            first = false;
+        }
+
+        uint64_t end = r->head.load(std::memory_order_acquire);
+        uint64_t begin = end > TRACE_RING_EVENTS ? end - TRACE_RING_EVENTS : 0;
+        events.resize(end - begin);
+        for (uint64_t i = begin; i < end; i++)
+            events[i - begin] = r->events[i & (TRACE_RING_EVENTS - 1)];
+
+        // Slots the thread reused while we were copying, and the one it may
+        // be writing right now
+        uint64_t now = r->head.load(std::memory_order_acquire) + 1;
+        uint64_t valid = now > TRACE_RING_EVENTS ? now - TRACE_RING_EVENTS : 0;
+
+        for (uint64_t i = std::max(begin, valid); i < end; i++) {
+            const trace_event & e = events[i - begin];
+            fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+                       "\"ts\":%.3f,\"dur\":%.3f}", first ? "" : ",\n",
+                e.name, pid, r->tid, e.begin / 1000.0, (e.end - e.begin) / 1000.0);
+            first = false;
+        }
+    }
+    fprintf(f, "\n]}\n");
+
+    if (fclose(f) != 0) {
+        fprintf(stderr, "Cannot write '%s': %d, %s\n", path, errno, strerror(errno));
+        return false;
+    }
+    fprintf(stderr, "Trace written to %s\n", path);
+    return true;
+}
+
+void trace_poll(void) {
+    if (dump_requested) {
+        dump_requested = 0;
+        trace_dump(trace_path());
+    }
+}
+
+static void sigusr1_handler(int) {
+    dump_requested = 1;
+}
+
+static void dump_at_exit(void) {
+    trace_dump(trace_path());
+}
+
+void trace_init(void) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigusr1_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+
+    atexit(dump_at_exit);
+    trace_thread_name("main");
+}
+
+#endif // MLX_TRACE